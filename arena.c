@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "log.h"
+#include "arena.h"
+
+/* Auxiliar function that maps the segment and fills the
+ * handle. Returns NULL on error.*/
+arena_t* arena_map(int shmid){
+	arena_t* arena = malloc(sizeof(arena_t));
+	if(!arena) return NULL;
+
+	void* shm = shmat(shmid, NULL, 0);
+	if(shm == (void*) -1) {
+		free(arena);
+		return NULL;
+	}
+	arena->shmid = shmid;
+	arena->base = (char*) shm;
+	arena->header = (arena_header_t*) shm;
+	return arena;
+}
+
+/* Returns the amount of arena space an allocation of the
+ * received size takes, counting its alignment.*/
+size_t arena_footprint(size_t size){
+	return ARENA_ALIGN_UP(size);
+}
+
+/* Creates a new arena with room for capacity bytes of
+ * allocations (as measured by arena_footprint), on a new
+ * shared memory segment identified by key. Returns NULL
+ * on error.*/
+arena_t* arena_create(key_t key, size_t capacity){
+	size_t size = arena_footprint(sizeof(arena_header_t)) + capacity;
+	int shmid = -1;
+	bool huge = false;
+
+#if ARENA_HUGE_PAGES
+	// Huge page segments must be a whole amount of pages
+	size_t huge_size = (size + ARENA_HUGE_PAGE_SIZE - 1) & ~(ARENA_HUGE_PAGE_SIZE - 1);
+	shmid = shmget(key, huge_size, IPC_CREAT | SHM_HUGETLB | 0644);
+	if(shmid >= 0) {
+		size = huge_size;
+		huge = true;
+	} else
+		log_write(INFO_L, "Arena: No huge pages available [errno: %d], using normal pages\n", errno);
+#endif
+	if(shmid < 0)
+		shmid = shmget(key, size, IPC_CREAT | 0644);
+	if(shmid < 0) {
+		log_write(ERROR_L, "Arena: Failed to get %zu bytes [errno: %d]\n", size, errno);
+		return NULL;
+	}
+
+	arena_t* arena = arena_map(shmid);
+	if(!arena) {
+		shmctl(shmid, IPC_RMID, NULL);
+		return NULL;
+	}
+
+	arena->header->magic = ARENA_MAGIC;
+	arena->header->huge_pages = huge;
+	arena->header->size = size;
+	arena->header->used = arena_footprint(sizeof(arena_header_t));
+	arena->header->root = ARENA_NULL;
+	return arena;
+}
+
+/* Attaches to the already existing arena identified by
+ * key. Returns NULL on error.*/
+arena_t* arena_attach(key_t key){
+	int shmid = shmget(key, 0, 0);
+	if(shmid < 0) return NULL;
+
+	arena_t* arena = arena_map(shmid);
+	if(!arena) return NULL;
+	if(arena->header->magic != ARENA_MAGIC) {
+		arena_destroy(arena);
+		return NULL;
+	}
+	return arena;
+}
+
+/* Carves size bytes, aligned to a cache line, from the
+ * arena. Returns its offset, or ARENA_NULL if the arena
+ * has not enough room left.*/
+arena_off_t arena_alloc(arena_t* arena, size_t size){
+	if(!arena) return ARENA_NULL;
+	arena_header_t* header = arena->header;
+	size_t footprint = arena_footprint(size);
+	if(header->used + footprint > header->size)
+		return ARENA_NULL;
+
+	arena_off_t off = header->used;
+	header->used += footprint;
+	memset(arena->base + off, 0, footprint);
+	return off;
+}
+
+/* Returns the address, on this process' mapping, of
+ * the received offset. Returns NULL for ARENA_NULL.*/
+void* arena_ptr(arena_t* arena, arena_off_t off){
+	if((!arena) || (off == ARENA_NULL)) return NULL;
+	return arena->base + off;
+}
+
+/* Sets or retrieves the offset of the arena's root allocation,
+ * from which an attached process finds everything else.*/
+void arena_set_root(arena_t* arena, arena_off_t off){
+	if(!arena) return;
+	arena->header->root = off;
+}
+
+arena_off_t arena_get_root(arena_t* arena){
+	if(!arena) return ARENA_NULL;
+	return arena->header->root;
+}
+
+/* Detaches the arena from this process and frees the handle.
+ * The segment itself is left as is.*/
+void arena_destroy(arena_t* arena){
+	if(!arena) return;
+	shmdt((void*) arena->base);
+	free(arena);
+}
+
+/* Detaches the arena and also removes its shared memory
+ * segment. Only the creator process should call it.*/
+void arena_free(arena_t* arena){
+	if(!arena) return;
+	int shmid = arena->shmid;
+	arena_destroy(arena);
+	shmctl(shmid, IPC_RMID, NULL);
+}
@@ -0,0 +1,92 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+
+// Every sub-allocation starts on its own cache line
+#define ARENA_ALIGN 64
+#define ARENA_ALIGN_UP(size) (((size) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+// Set this flag to try backing the arena with huge pages; if
+// the system has none reserved, normal pages are used instead
+#define ARENA_HUGE_PAGES 1
+#define ARENA_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+#define ARENA_MAGIC 0xC0C0A7E4
+
+/*
+ * An arena is a single shared memory segment from which every
+ * shared structure of the tournament is carved, once, at setup.
+ * Allocations are never freed one by one: the whole segment
+ * goes away with arena_free.
+ *
+ * Sub-allocations are referred to by their offset from the start
+ * of the segment instead of by pointer, so a handle stays valid
+ * no matter where each process maps the segment. That way, any
+ * process (even one not forked from main) can arena_attach by key
+ * and find every table from the root offset.
+ */
+
+// Offset of a sub-allocation. Offset 0 is the header, so it
+// doubles as the invalid handle.
+typedef size_t arena_off_t;
+#define ARENA_NULL ((arena_off_t) 0)
+
+/* Header stored at the start of the segment.*/
+typedef struct arena_header_ {
+	uint32_t magic;
+	bool huge_pages;
+	size_t size;
+	size_t used;
+	arena_off_t root;
+} arena_header_t;
+
+/* Per process handle of an arena.*/
+typedef struct arena_ {
+	int shmid;
+	char* base;
+	arena_header_t* header;
+} arena_t;
+
+/* Returns the amount of arena space an allocation of the
+ * received size takes, counting its alignment.*/
+size_t arena_footprint(size_t size);
+
+/* Creates a new arena with room for capacity bytes of
+ * allocations (as measured by arena_footprint), on a new
+ * shared memory segment identified by key. Returns NULL
+ * on error.*/
+arena_t* arena_create(key_t key, size_t capacity);
+
+/* Attaches to the already existing arena identified by
+ * key. Returns NULL on error.*/
+arena_t* arena_attach(key_t key);
+
+/* Carves size bytes, aligned to a cache line, from the
+ * arena. Returns its offset, or ARENA_NULL if the arena
+ * has not enough room left.*/
+arena_off_t arena_alloc(arena_t* arena, size_t size);
+
+/* Returns the address, on this process' mapping, of
+ * the received offset. Returns NULL for ARENA_NULL.*/
+void* arena_ptr(arena_t* arena, arena_off_t off);
+
+/* Sets or retrieves the offset of the arena's root allocation,
+ * from which an attached process finds everything else.*/
+void arena_set_root(arena_t* arena, arena_off_t off);
+arena_off_t arena_get_root(arena_t* arena);
+
+/* Detaches the arena from this process and frees the handle.
+ * The segment itself is left as is.*/
+void arena_destroy(arena_t* arena);
+
+/* Detaches the arena and also removes its shared memory
+ * segment. Only the creator process should call it.*/
+void arena_free(arena_t* arena);
+
+#endif
@@ -1,71 +1,222 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
+#include <errno.h>
 #include "confparser.h"
+#include "tournament.h"
+#include "tuning.h"
+#include "retry.h"
 
-/* Stores the value of the parameter received
- * into the respective field of struct conf sc.*/
-void parse_value(struct conf* sc, char* param, size_t p_value){
-	if((!sc) || (!param)) return;
-	
-	if(strcmp(param, "F") == 0) {
-		sc->rows = p_value;
-		return;
-		}
-		
-	if(strcmp(param, "P") == 0) {
-		sc->players = p_value;
-		return;
-		}
-		
-	if(strcmp(param, "K") == 0) {
-		sc->matches = p_value;
-		return;
-		}
-		
-	if(strcmp(param, "D") == 0) {
-		sc->debug = (p_value == 0 ? false : true);
-		return;
-		}		
-		
-	if(strcmp(param, "C") == 0) {
-		sc->cols = p_value;
-		return;
-		}				
-		
-	if(strcmp(param, "M") == 0) {
-		sc->capacity = p_value;
-		return;
-		}
+/* Kind of value a parameter holds.*/
+typedef enum conf_type_ {CONF_SIZE, CONF_BOOL} conf_type;
+
+/* Description of a parameter: its key, where it goes inside
+ * struct conf, its valid range and its default value (only
+ * used if it's not required).*/
+typedef struct conf_param_ {
+	const char* key;
+	size_t offset;
+	conf_type type;
+	size_t min;
+	size_t max;
+	bool required;
+	size_t def;
+} conf_param_t;
+
+#define CONF_FIELD(field) offsetof(struct conf, field)
+
+static const conf_param_t conf_params[] = {
+	{"F", CONF_FIELD(rows), CONF_SIZE, 1, MAX_COURTS, true, 0},
+	{"C", CONF_FIELD(cols), CONF_SIZE, 1, MAX_COURTS, true, 0},
+	{"K", CONF_FIELD(matches), CONF_SIZE, 1, MAX_NUM_MATCHES, true, 0},
+	{"M", CONF_FIELD(capacity), CONF_SIZE, 1, MAX_PLAYERS, true, 0},
+	{"P", CONF_FIELD(players), CONF_SIZE, MIN_PLAYERS_TO_START, MAX_PLAYERS, true, 0},
+	{"D", CONF_FIELD(debug), CONF_BOOL, 0, 1, true, 0},
+	{"R", CONF_FIELD(rolling), CONF_BOOL, 0, 1, true, 0},
+	{"B", CONF_FIELD(balanced), CONF_BOOL, 0, 1, true, 0},
+	{"S", CONF_FIELD(seed), CONF_SIZE, 0, 0xFFFFFFFF, false, 0},
+	{"T", CONF_FIELD(random_tides), CONF_BOOL, 0, 1, false, 0},
+	{"TF", CONF_FIELD(tide_flow_mean), CONF_SIZE, 0, 3600000, false, 3000},
+	{"TE", CONF_FIELD(tide_ebb_mean), CONF_SIZE, 0, 3600000, false, 2000},
+	{"TL", CONF_FIELD(tide_max_level), CONF_SIZE, 0, MAX_COURTS, false, 1},
+	{"X", CONF_FIELD(time_scale), CONF_SIZE, 1, 10000, false, 1},
+	{"SCORE_MIN", CONF_FIELD(score_min), CONF_SIZE, 0, 60000000, false, TUNING_SCORE_MIN},
+	{"SCORE_MAX", CONF_FIELD(score_max), CONF_SIZE, 1, 60000000, false, TUNING_SCORE_MAX},
+	{"SET_MIN", CONF_FIELD(set_min), CONF_SIZE, 0, 600000000, false, TUNING_SET_MIN},
+	{"SET_MAX", CONF_FIELD(set_max), CONF_SIZE, 1, 600000000, false, TUNING_SET_MAX},
+	{"REST_MAX", CONF_FIELD(rest_max), CONF_SIZE, 1, 600000000, false, TUNING_REST_MAX},
+	{"RETRY_MAX", CONF_FIELD(retry_max), CONF_SIZE, 1, 600000000, false, TUNING_RETRY_MAX},
+	{"PARK_TIMEOUT", CONF_FIELD(park_timeout), CONF_SIZE, 1, 600000000, false, TUNING_PARK_TIMEOUT},
+	{"PARK_GRACE", CONF_FIELD(park_grace), CONF_SIZE, 0, 600000000, false, TUNING_PARK_GRACE},
+	{"BACKOFF_MIN", CONF_FIELD(backoff_min), CONF_SIZE, 1, 600000000, false, TUNING_BACKOFF_MIN},
+	{"RETRY", CONF_FIELD(retry_policy), CONF_SIZE, 0, RETRY_POLICIES - 1, false, RETRY_DEFAULT},
+	{"LEAVE_PROB", CONF_FIELD(leave_prob), CONF_SIZE, 0, 100, false, TUNING_LEAVE_PROB},
+	{"REST_PROB", CONF_FIELD(rest_prob), CONF_SIZE, 0, 100, false, TUNING_REST_PROB},
+	{"ATTEMPTS", CONF_FIELD(max_attempts), CONF_SIZE, 1, 1000, false, TUNING_MAX_ATTEMPTS},
+};
+
+#define CONF_PARAMS_AMOUNT (sizeof(conf_params) / sizeof(conf_param_t))
+
+/* Auxiliar function that returns the index of the parameter
+ * with the received key, or -1 if there's none.*/
+int conf_param_find(const char* key){
+	size_t i;
+	for(i = 0; i < CONF_PARAMS_AMOUNT; i++)
+		if(strcmp(conf_params[i].key, key) == 0)
+			return (int) i;
+	return -1;
+}
+
+/* Auxiliar function that parses the received value for the
+ * i-th parameter and stores it at sc. Returns false (and says
+ * why) if the value isn't a number in the parameter's range.*/
+bool conf_param_set(struct conf* sc, int i, const char* value, const char* origin){
+	const conf_param_t* param = &conf_params[i];
+	char* end = NULL;
+	errno = 0;
+	unsigned long long v = strtoull(value, &end, 10);
+	if((value[0] == '-') || (end == value) || (*end != '\0') || (errno == ERANGE)) {
+		printf("Error! %s: value '%s' for parameter %s is not a number\n", origin, value, param->key);
+		return false;
+	}
+	if((v < param->min) || (v > param->max)) {
+		printf("Error! %s: parameter %s must be between %zu and %zu (got %llu)\n", origin, param->key, param->min, param->max, v);
+		return false;
+	}
+
+	void* field = (char*) sc + param->offset;
+	if(param->type == CONF_BOOL)
+		*(bool*) field = (v != 0);
+	else
+		*(size_t*) field = (size_t) v;
+	return true;
 }
 
-/* Reads configuration file and stores its
- * contents at sc. Returns true if the operation
- * was successful, false otherwise. Take note
- * that if any parameter from struct conf is
- * missing at the configuration file, the value
- * returned will be false, even if other fields
- * were successfully read.*/
-bool read_conf_file(struct conf* sc){
-	FILE *pf = fopen(CONF_ROUTE, "r");
-	if(!pf) return false;
-	int parsed_amount = 0, r = 8;
+/* Stores the default value of every parameter that isn't
+ * required into sc.*/
+void conf_set_defaults(struct conf* sc){
+	if(!sc) return;
+	size_t i;
+	for(i = 0; i < CONF_PARAMS_AMOUNT; i++) {
+		if(conf_params[i].required) continue;
+		void* field = (char*) sc + conf_params[i].offset;
+		if(conf_params[i].type == CONF_BOOL)
+			*(bool*) field = (conf_params[i].def != 0);
+		else
+			*(size_t*) field = conf_params[i].def;
+	}
+}
+
+/* Reads the configuration file at path and stores its
+ * contents at sc. Lines other than "<key> : <value>" are
+ * taken as comments. Returns true if the operation was
+ * successful, false otherwise. Take note that if any
+ * required parameter is missing at the configuration
+ * file, or any value is invalid, the value returned will
+ * be false, even if other fields were successfully read.*/
+bool read_conf_file(struct conf* sc, const char* path){
+	if((!sc) || (!path)) return false;
+	FILE *pf = fopen(path, "r");
+	if(!pf) {
+		printf("Error! Couldn't open conf file %s\n", path);
+		return false;
+	}
+	conf_set_defaults(sc);
+
+	bool seen[CONF_PARAMS_AMOUNT] = {false};
+	bool ok = true;
+	char line[256];
 	// For every line in pf, parse its value
-	while(r > 0){
-		char param[15];
-		size_t p_value = 0;
-		r = fscanf(pf, "%s : %d\n", param, &p_value);
-		if(r == 2) {
-			parse_value(sc, param, p_value);
-			parsed_amount++;
-			}
+	while(fgets(line, sizeof(line), pf)) {
+		char key[16], value[32], extra;
+		if(sscanf(line, "%15[A-Za-z_] : %31s %c", key, value, &extra) != 2)
+			continue;
+		int i = conf_param_find(key);
+		if(i < 0) {
+			printf("Error! %s: unknown parameter %s\n", path, key);
+			ok = false;
+			continue;
 		}
-	fclose(pf);	
-	// Check all fields were correctly parsed
-	int expected_amount = sizeof(struct conf) / sizeof(size_t);
-	if(expected_amount == parsed_amount)
-		return true;
-	printf("Error! Missing parameters or conf file format invalid\n");
-	return false;
+		if(!conf_param_set(sc, i, value, path))
+			ok = false;
+		seen[i] = true;
+	}
+	fclose(pf);
+
+	// Check all required fields were parsed
+	size_t i;
+	for(i = 0; i < CONF_PARAMS_AMOUNT; i++) {
+		if(conf_params[i].required && !seen[i]) {
+			printf("Error! %s: missing parameter %s\n", path, conf_params[i].key);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+/* Overrides a parameter of sc with the received "key=value"
+ * string (as given on the command line). Returns false if
+ * it isn't valid.*/
+bool conf_override(struct conf* sc, const char* arg){
+	if((!sc) || (!arg)) return false;
+	const char* eq = strchr(arg, '=');
+	if((!eq) || (eq == arg) || (eq - arg >= 16)) {
+		printf("Error! Override '%s' is not in key=value format\n", arg);
+		return false;
+	}
+	char key[16];
+	memcpy(key, arg, eq - arg);
+	key[eq - arg] = '\0';
+	int i = conf_param_find(key);
+	if(i < 0) {
+		printf("Error! Override '%s': unknown parameter %s\n", arg, key);
+		return false;
+	}
+	return conf_param_set(sc, i, eq + 1, "command line");
+}
+
+/* Checks the constraints among parameters of sc that
+ * can't be checked one by one. Returns false if any
+ * of them doesn't hold.*/
+bool conf_validate(struct conf* sc){
+	if(!sc) return false;
+	if(sc->rows * sc->cols > MAX_COURTS) {
+		printf("Error! F * C must be at most %d courts (got %zu)\n", MAX_COURTS, sc->rows * sc->cols);
+		return false;
+	}
+	if(sc->score_min > sc->score_max) {
+		printf("Error! SCORE_MIN can't be greater than SCORE_MAX\n");
+		return false;
+	}
+	if(sc->set_min >= sc->set_max) {
+		printf("Error! SET_MIN must be lower than SET_MAX\n");
+		return false;
+	}
+	if(sc->leave_prob > sc->rest_prob) {
+		printf("Error! LEAVE_PROB can't be greater than REST_PROB, which includes it\n");
+		return false;
+	}
+	return true;
+}
+
+/* Fills sc from the command line received: an optional
+ * configuration file path first (CONF_ROUTE if missing),
+ * followed by any amount of "key=value" overrides. Returns
+ * false if anything is missing or invalid.*/
+bool conf_load(struct conf* sc, int argc, char** argv){
+	if(!sc) return false;
+	const char* path = CONF_ROUTE;
+	int i = 1;
+	if((argc > 1) && (!strchr(argv[1], '='))) {
+		path = argv[1];
+		i++;
+	}
+	if(!read_conf_file(sc, path))
+		return false;
+	for(; i < argc; i++)
+		if(!conf_override(sc, argv[i]))
+			return false;
+	return conf_validate(sc);
 }
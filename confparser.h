@@ -6,10 +6,13 @@
 #include <stdbool.h>
 #include <string.h>
 
+// Configuration file used if none is given on the command line
 #define CONF_ROUTE "conf.txt"
 
 /* struct conf: an aux structure for parsing the
- * configuration file at path CONF_ROUTE. */
+ * configuration file (CONF_ROUTE by default). Every
+ * parameter, its key and its valid range are listed
+ * in the table at confparser.c. */
 struct conf {
 	size_t rows;
 	size_t cols;
@@ -17,19 +20,62 @@ struct conf {
 	size_t capacity;
 	size_t players;
 	bool debug;
+	bool rolling;
+	bool balanced;
+	// Seeds every random choice; 0 picks one from the clock
+	size_t seed;
+	// Random tides (see tide.h): mean milliseconds between
+	// flows and between ebbs, and highest level
+	bool random_tides;
+	size_t tide_flow_mean;
+	size_t tide_ebb_mean;
+	size_t tide_max_level;
+	// Timing of players and courts (see tuning.h): every
+	// time is divided by time_scale
+	size_t time_scale;
+	size_t score_min;
+	size_t score_max;
+	size_t set_min;
+	size_t set_max;
+	size_t rest_max;
+	size_t retry_max;
+	size_t park_timeout;
+	size_t park_grace;
+	size_t backoff_min;
+	// Retry policy of players (see retry.h)
+	size_t retry_policy;
+	size_t leave_prob;
+	size_t rest_prob;
+	size_t max_attempts;
 };
 
-/* Stores the value of the parameter received
- * into the respective field of struct conf sc.*/
-void parse_value(struct conf* sc, char* param, size_t p_value);
-
-/* Reads configuration file and stores its
- * contents at sc. Returns true if the operation
- * was successful, false otherwise. Take note
- * that if any parameter from struct conf is
- * missing at the configuration file, the value
- * returned will be false, even if other fields
- * were successfully read.*/
-bool read_conf_file(struct conf* sc);
+/* Stores the default value of every parameter that isn't
+ * required into sc.*/
+void conf_set_defaults(struct conf* sc);
+
+/* Reads the configuration file at path and stores its
+ * contents at sc. Lines other than "<key> : <value>" are
+ * taken as comments. Returns true if the operation was
+ * successful, false otherwise. Take note that if any
+ * required parameter is missing at the configuration
+ * file, or any value is invalid, the value returned will
+ * be false, even if other fields were successfully read.*/
+bool read_conf_file(struct conf* sc, const char* path);
+
+/* Overrides a parameter of sc with the received "key=value"
+ * string (as given on the command line). Returns false if
+ * it isn't valid.*/
+bool conf_override(struct conf* sc, const char* arg);
+
+/* Checks the constraints among parameters of sc that
+ * can't be checked one by one. Returns false if any
+ * of them doesn't hold.*/
+bool conf_validate(struct conf* sc);
+
+/* Fills sc from the command line received: an optional
+ * configuration file path first (CONF_ROUTE if missing),
+ * followed by any amount of "key=value" overrides. Returns
+ * false if anything is missing or invalid.*/
+bool conf_load(struct conf* sc, int argc, char** argv);
 
 #endif
@@ -10,16 +10,22 @@
 #include <errno.h>
 #include <assert.h>
 #include "court.h"
+#include "futex.h"
 #include "log.h"
 #include "score_table.h"
 #include "partners_table.h"
 #include "tournament.h"
+#include "latency_table.h"
+#include "player.h"
 
 #include "protocol.h"
 
-// In microseconds!
-#define SET_MAX_DURATION 200000
-#define SET_MIN_DURATION 70000 
+// Match duration prediction: expected sets times the mean set
+// length (set on tuning.h), plus a rough allowance for
+// collecting scores. In microseconds, before scaling!
+#define SET_OVERHEAD 5000
+// How sharply the gap between teams turns into set wins
+#define SKILL_GAP_SHARPNESS 8.0
 
 
 // --------------- Court team section --------------
@@ -43,9 +49,14 @@ bool court_team_is_full(court_team_t team){
 bool court_team_player_can_join_team(court_team_t team, unsigned int player_id, partners_table_t* pt){
 	if(court_team_is_full(team)) return false;
 	// If playerd_id has already played with any team member, returns false
+	unsigned int ids[PLAYERS_PER_TEAM + 1];
 	int i;
 	for (i = 0; i < team.team_size; i++)
-		if(get_played_together(pt, team.team_players[i], player_id))
+		ids[i] = team.team_players[i];
+	ids[team.team_size] = player_id;
+	uint64_t allowed = partners_table_allowed_pairs(pt, ids, team.team_size + 1);
+	for (i = 0; i < team.team_size; i++)
+		if(!(allowed & PARTNERS_PAIR_BIT(i, team.team_size)))
 			return false;
 	return true;
 }
@@ -75,6 +86,90 @@ void court_team_add_score_players(court_team_t team, score_table_t* st, int scor
 
 // --------------- Auxiliar functions ---------------
 
+/* Returns the points per second the received players are
+ * expected to score together.*/
+double court_players_rate(const unsigned int* ids, size_t n){
+	court_t* court = court_get_instance();
+	double rate = 0;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		size_t skill = court->tm->tm_data->tm_players_state[ids[i]].player_skill;
+		rate += 1000000.0 / player_mean_score_time(court->tm->tuning, skill);
+	}
+	return rate;
+}
+
+/* Returns the chance of a team scoring rate_home points per
+ * second to win a set against one scoring rate_away.*/
+double court_set_win_prob(double rate_home, double rate_away){
+	double x = SKILL_GAP_SHARPNESS * (rate_home - rate_away) / (rate_home + rate_away);
+	return 0.5 + 0.5 * x / (1 + (x < 0 ? -x : x));
+}
+
+/* Returns how many sets a match is expected to last, if home
+ * team wins each set with probability p. The match ends at
+ * set n if either team gets its SETS_WINNING-th win there.*/
+double court_expected_sets(double p){
+	double q = 1 - p, expected = 0, ways = 1;
+	int n, i;
+	for (n = SETS_WINNING; n < 2 * SETS_WINNING; n++) {
+		// Ways of spreading the loser's n - SETS_WINNING wins
+		// over the first n - 1 sets
+		int losses = n - SETS_WINNING;
+		ways = 1;
+		for (i = 1; i <= losses; i++)
+			ways = ways * (n - 1 - losses + i) / i;
+		double p_home = 1, p_away = 1;
+		for (i = 0; i < SETS_WINNING; i++) {
+			p_home *= p;
+			p_away *= q;
+		}
+		for (i = 0; i < losses; i++) {
+			p_home *= q;
+			p_away *= p;
+		}
+		expected += n * ways * (p_home + p_away);
+	}
+	return expected;
+}
+
+/* Returns the predicted duration (in microseconds) of a match
+ * between the two teams received.*/
+uint64_t court_predict_duration(const unsigned int* home, const unsigned int* away){
+	const tuning_t* tn = court_get_instance()->tm->tuning;
+	double p = court_set_win_prob(court_players_rate(home, PLAYERS_PER_TEAM), court_players_rate(away, PLAYERS_PER_TEAM));
+	uint64_t set_mean = (tn->set_min + tn->set_max) / 2;
+	return (uint64_t) (court_expected_sets(p) * (set_mean + tuning_scale(tn, SET_OVERHEAD)));
+}
+
+/* Picks one of the valid splits (a mask, as returned by
+ * partners_table_valid_splits) for the four candidates. On
+ * balanced tournaments, the one with the lowest gap between
+ * the teams' skills; otherwise, just the first one.*/
+unsigned int court_pick_split(const unsigned int* ids, unsigned int splits){
+	court_t* court = court_get_instance();
+	unsigned int best = __builtin_ctz(splits);
+	if (!court->tm->tm_data->tm_balanced_teams)
+		return best;
+
+	player_state_t* ps = court->tm->tm_data->tm_players_state;
+	long int best_gap = -1;
+	unsigned int k;
+	for (k = 0; k < PARTNERS_SPLITS; k++) {
+		if (!(splits & (1U << k))) continue;
+		unsigned int home[PLAYERS_PER_TEAM], away[PLAYERS_PER_TEAM];
+		partners_split_members(k, home, away);
+		long int gap = (long int) (ps[ids[home[0]]].player_skill + ps[ids[home[1]]].player_skill)
+				- (long int) (ps[ids[away[0]]].player_skill + ps[ids[away[1]]].player_skill);
+		if (gap < 0) gap = -gap;
+		if ((best_gap < 0) || (gap < best_gap)) {
+			best_gap = gap;
+			best = k;
+		}
+	}
+	return best;
+}
+
 /* Returns a number between 0 and PLAYERS_PER_MATCH -1 which 
  * represents the "player_court_id", a player id that is 
  * "relative" to this court. If the player_id received doesn't
@@ -119,20 +214,20 @@ void manage_players_scores(){
 		case 0:
 		case 1:
 			assert(court->team_away.sets_won == 3);
-			court_team_add_score_players(court->team_away, court->tm->tm_data->st, 3);
+			court_team_add_score_players(court->team_away, court->tm->st, 3);
 			break;
 		case 2:
 			assert(court->team_away.sets_won == 3);
-			court_team_add_score_players(court->team_away, court->tm->tm_data->st, 2);
-			court_team_add_score_players(court->team_home, court->tm->tm_data->st, 1);
+			court_team_add_score_players(court->team_away, court->tm->st, 2);
+			court_team_add_score_players(court->team_home, court->tm->st, 1);
 			break;
 		case 3:
 			if(court->team_away.sets_won == 2){
-				court_team_add_score_players(court->team_away, court->tm->tm_data->st, 1);
-				court_team_add_score_players(court->team_home, court->tm->tm_data->st, 2);
+				court_team_add_score_players(court->team_away, court->tm->st, 1);
+				court_team_add_score_players(court->team_home, court->tm->st, 2);
 			}
 			else
-				court_team_add_score_players(court->team_home, court->tm->tm_data->st, 3);
+				court_team_add_score_players(court->team_home, court->tm->st, 3);
 			break;
 	}
 }
@@ -163,18 +258,25 @@ void update_player_match_data() {
 	lock_release(court->tm->tm_lock);
 }
 
-void connect_player_in_team(unsigned int p_id, unsigned int team){
+/* Returns the channel the court tells its players about
+ * the match on.*/
+broadcast_t* court_broadcast(court_t* court){
+	return &court->tm->tm_data->tm_courts[court->court_id].court_broadcast;
+}
+
+/* Accepts the received player on the lobby, as a candidate
+ * for the match. Teams are not assigned until the court is full.*/
+void court_accept_candidate(unsigned int p_id){
 	court_t* court = court_get_instance();
-	if(team == 0)
-		court_team_join_player(&court->team_home, p_id);
-	if(team == 1)
-		court_team_join_player(&court->team_away, p_id);
+	court->candidates[court->connected_players] = p_id;
 	
-	log_write(INFO_L, "Court %03d: Player %03d is connected at this court for team %d\n", court->court_id, p_id, team + 1);
+	log_write(INFO_L, "Court %03d: Player %03d is connected at this court\n", court->court_id, p_id);
 
 	message_t msg = {};
 	msg.m_player_id = p_id;
 	msg.m_type = MSG_MATCH_ACCEPT;
+	// From now on, the player follows the match on the channel
+	msg.m_broadcast = broadcast_current(court_broadcast(court));
 
 	if (!send_msg(court->player_fifos[court->connected_players], &msg)) {
 		log_write(ERROR_L, "Court %03d: Failed to send accept msg to player %03d [errno: %d]\n", court->court_id, p_id, errno);
@@ -184,6 +286,73 @@ void connect_player_in_team(unsigned int p_id, unsigned int team){
 	court->connected_players++;
 }
 
+/* Splits the four candidates in teams as the received split
+ * says (see partners_table.h), and reorders their fifos so that
+ * player_fifos[i] belongs to the player with court id i.*/
+void court_form_teams(unsigned int split){
+	court_t* court = court_get_instance();
+	unsigned int home[PLAYERS_PER_TEAM], away[PLAYERS_PER_TEAM];
+	partners_split_members(split, home, away);
+	unsigned int order[PLAYERS_PER_MATCH] = {home[0], home[1], away[0], away[1]};
+
+	unsigned int ids[PLAYERS_PER_MATCH];
+	int fifos[PLAYERS_PER_MATCH];
+	int i;
+	for (i = 0; i < PLAYERS_PER_MATCH; i++) {
+		ids[i] = court->candidates[order[i]];
+		fifos[i] = court->player_fifos[order[i]];
+	}
+
+	court_team_initialize(&court->team_home);
+	court_team_initialize(&court->team_away);
+	for (i = 0; i < PLAYERS_PER_MATCH; i++) {
+		court->candidates[i] = ids[i];
+		court->player_fifos[i] = fifos[i];
+		court_team_join_player((i < PLAYERS_PER_TEAM ? &court->team_home : &court->team_away), ids[i]);
+	}
+	log_write(INFO_L, "Court %03d: Teams are %03d & %03d VS %03d & %03d\n", court->court_id, ids[0], ids[1], ids[2], ids[3]);
+
+	// Publish when the match should be over
+	uint64_t duration = court_predict_duration(ids, ids + PLAYERS_PER_TEAM);
+	court->match_started_at = latency_now();
+	lock_acquire(court->tm->tm_lock);
+	court->tm->tm_data->tm_courts[court->court_id].court_predicted_end = court->match_started_at + duration;
+	lock_release(court->tm->tm_lock);
+	log_write(INFO_L, "Court %03d: Match predicted to last %llu ms\n", court->court_id, (unsigned long long) (duration / 1000));
+}
+
+/* Returns true if the court is under water.*/
+bool court_is_flooded(court_t* court){
+	return court->flood && (__atomic_load_n(court->flood, __ATOMIC_ACQUIRE) != 0);
+}
+
+/* Returns true if the tide came and went before the court got to
+ * look at it: the court is still marked as flooded, but it's dry.*/
+bool court_flood_missed(court_t* court){
+	lock_acquire(court->tm->tm_lock);
+	bool missed = (!court_is_flooded(court)) && (TM_COURT_STATUS(court->tm, court->court_id) == TM_C_FLOODED);
+	lock_release(court->tm->tm_lock);
+	return missed;
+}
+
+/* Once the water went down, and the court (with no players in)
+ * is done with the flood, marks it as free again. Does nothing
+ * if the tide is back, or the court wasn't flooded.*/
+void court_dry(court_t* court){
+	lock_acquire(court->tm->tm_lock);
+	if ((!court_is_flooded(court)) && (TM_COURT_STATUS(court->tm, court->court_id) == TM_C_FLOODED))
+		tournament_court_freed(court->tm, court->court_id);
+	lock_release(court->tm->tm_lock);
+}
+
+/* Lets a set be played for usec microseconds. Returns earlier
+ * if the tide floods the court meanwhile.*/
+void court_wait_set(court_t* court, unsigned long int usec){
+	uint64_t deadline = latency_now() + usec;
+	while ((!court_is_flooded(court)) && (latency_now() < deadline))
+		futex_wait_until(court->flood, 0, deadline);
+}
+
 /* Kicks every player from the court. This function should be used when
  * the players on the court have been alread accepted on the court (i.e.
  * they were accepted and remained too long, hence should be kicked).
@@ -196,39 +365,55 @@ void kick_all_players(bool court_available){
 	// Kick all players!
 	int i;
 	for(i = 0; i < court->connected_players; i++) {
-		int p_id = court_court_id_to_player(i);
+		int p_id = court->candidates[i];
 		
-		if (court->flooded)
+		if (court_is_flooded(court))
 			log_write(INFO_L, "Court %03d: Player %03d is kicked due to court flooding!\n", court->court_id, p_id);
 		else
 			log_write(INFO_L, "Court %03d: Player %03d remained too long, let's kick them!\n", court->court_id, p_id);
 
-		message_t msg = {};
-		msg.m_player_id = p_id;
-		msg.m_type = MSG_MATCH_REJECT;
-		if (!send_msg(court->player_fifos[i], &msg)) {
-			log_write(ERROR_L, "Court %03d: Failed to send reject msg to player %03d [errno: %d]\n", court->court_id, p_id, errno);
-			exit(-1);
-		}
 		if(court->player_fifos[i] > 0)
 			close(court->player_fifos[i]);
 	}
+	// Players already accepted only listen to the channel
+	if (court->connected_players > 0)
+		broadcast_send(court_broadcast(court), MSG_MATCH_REJECT, court->connected_players);
+
+	// Only the ones who joined leave: a player who took a slot
+	// but wasn't read yet still comes (and is counted when
+	// accepted or rejected), so their slot is kept
+	court_data_t* cd = &court->tm->tm_data->tm_courts[court->court_id];
+	uint8_t num_players = TM_COURT_NUM_PLAYERS(court->tm, court->court_id);
+	uint8_t kept = 0;
+	int j;
+	for (i = 0; i < num_players; i++) {
+		bool joined = false;
+		for (j = 0; j < court->connected_players; j++)
+			if (court->candidates[j] == cd->court_players[i])
+				joined = true;
+		if (!joined)
+			cd->court_players[kept++] = cd->court_players[i];
+	}
+	for (i = kept; i < PLAYERS_PER_MATCH; i++)
+		cd->court_players[i] = INVALID_PLAYER_ID;
+	TM_COURT_NUM_PLAYERS(court->tm, court->court_id) = kept;
+	cd->court_predicted_end = 0;
+
 	court->connected_players = 0;
 	court_team_initialize(&court->team_home);
 	court_team_initialize(&court->team_away);
-	if(court->court_fifo > 0)
-		close(court->court_fifo);
-	court->court_fifo = -1;
 
 	for (i = 0; i < PLAYERS_PER_MATCH; i++) 
 		court->player_fifos[i] = -1;
-			
-	if (!court->flooded)
-		court->tm->tm_data->tm_courts[court->court_id].court_status = (court_available ? TM_C_FREE : TM_C_DISABLED);
 
-	court->tm->tm_data->tm_courts[court->court_id].court_num_players = 0;
-	for(i = 0; i < PLAYERS_PER_MATCH; i++)
-		court->tm->tm_data->tm_courts[court->court_id].court_players[i] = INVALID_PLAYER_ID;
+	// A court claiming a suspended match keeps waiting for it
+	bool resuming = (court->tm->tm_data->tm_courts[court->court_id].court_resume >= 0);
+	if ((!court_is_flooded(court)) && (!resuming)) {
+		if (court_available)
+			tournament_court_freed(court->tm, court->court_id);
+		else
+			TM_COURT_STATUS(court->tm, court->court_id) = TM_C_DISABLED;
+	}
 	lock_release(court->tm->tm_lock);
 }
 
@@ -246,13 +431,27 @@ void reject_player(unsigned int p_id) {
 		exit(-1);
 	}
 	close(court->player_fifos[court->connected_players]);
+	court->player_fifos[court->connected_players] = -1;
 	
-	court_data_t cd = court->tm->tm_data->tm_courts[court->court_id];
-
-	cd.court_num_players--;
-	cd.court_players[cd.court_num_players] = INVALID_PLAYER_ID;
-	cd.court_status = TM_C_FREE;
-	court->tm->tm_data->tm_courts[court->court_id] = cd;
+	// Their slot is given back. Kicking everybody may have
+	// already taken them out
+	court_data_t* cd = &court->tm->tm_data->tm_courts[court->court_id];
+	uint8_t num_players = TM_COURT_NUM_PLAYERS(court->tm, court->court_id);
+	int i;
+	for (i = 0; (i < num_players) && (cd->court_players[i] != p_id); i++);
+	if (i < num_players) {
+		for (; i < num_players - 1; i++)
+			cd->court_players[i] = cd->court_players[i + 1];
+		cd->court_players[i] = INVALID_PLAYER_ID;
+		TM_COURT_NUM_PLAYERS(court->tm, court->court_id) = --num_players;
+	}
+	// The slot left can be taken by someone waiting, unless the
+	// court is flooded, closing or kept for a suspended match
+	uint8_t status = TM_COURT_STATUS(court->tm, court->court_id);
+	if ((status == TM_C_FREE) || (status == TM_C_BUSY)) {
+		TM_COURT_STATUS(court->tm, court->court_id) = TM_C_FREE;
+		tournament_wake_waiting(court->tm, 1);
+	}
 
 	lock_release(court->tm->tm_lock);
 }
@@ -260,121 +459,80 @@ void reject_player(unsigned int p_id) {
 /* Pretty self-descripting function.*/
 void court_self_destruct(){
 	court_t* court = court_get_instance();
+	log_write(INFO_L, "Court %03d: No more matches can be played. Self-destruct protocol started.\n", court->court_id);
 	lock_acquire(court->tm->tm_lock);
-	court->tm->tm_data->tm_courts[court->court_id].court_status = TM_C_DISABLED;
+	TM_COURT_STATUS(court->tm, court->court_id) = TM_C_DISABLED;
 	lock_release(court->tm->tm_lock);
 	// If there were players inside, let'em go
-	court_finish_set();
 	kick_all_players(false);
 	
-	lock_acquire(court->tm->tm_lock);
-	score_table_print(court->tm->tm_data->st);
 	log_write(DEBUG_L, "Court %03d: Destroying court\n", court->court_id);
-	lock_release(court->tm->tm_lock);
 	court_destroy(court);
 	log_close();
 	
 	exit(0);
 }
 		
-/* Handler function for SIG_TIDE signal*/
-void court_handler_tide(int signum) {
-	assert(signum == SIG_TIDE);
-	court_t* court = court_get_instance();
-	tournament_t* tm = court->tm;
-	if (tm->tm_data->tm_courts[court->court_id].court_status == TM_C_FLOODED) {
-		court->flooded = true;
-	} else {
-		court->flooded = false;
-		sem_post(court->flood_sem, court->court_id);
-	}
-}
-
-void court_set_tide_handler() {
-	// Set the hanlder for the SIG_TIDE signal
-	struct sigaction sa;
-	sigset_t sigset;	
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = 0;
-	sa.sa_handler = court_handler_tide;
-	sigaction(SIG_TIDE, &sa, NULL);
-}
-
-/* Handler function for SIGTERM signal*/
-void court_handler_termination(int signum) {
-	assert(signum == SIGTERM);
-	court_t* court = court_get_instance();
-	log_write(INFO_L, "Court %03d: No more matches can be played. Self-destruct protocol started.\n", court->court_id);
-	court_self_destruct();
-}
-
-void court_set_termination_handler() {
-	// Set the hanlder for the SIGTERM signal
-	struct sigaction sa;
-	sigset_t sigset;	
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = 0;
-	sa.sa_handler = court_handler_termination;
-	sigaction(SIGTERM, &sa, NULL);
-}
-
 /* Marks each player's partner on the partners_table stored at court.*/
 void mark_players_partners(){
 	court_t* court = court_get_instance();
-	if((!court) || (!court->tm->tm_data->pt)) return;
+	if((!court) || (!court->tm->pt)) return;
 	// Mark each players' partner (home)
 	int i, j;
 	for(i = 0; i < PLAYERS_PER_TEAM; i++)
 		for(j = i + 1; j < PLAYERS_PER_TEAM; j++) {
 			unsigned int p1 = court->team_home.team_players[i];
 			unsigned int p2 = court->team_home.team_players[j];
-			set_played_together(court->tm->tm_data->pt, p1, p2);
+			set_played_together(court->tm->pt, p1, p2);
 			}
 	// Mark each players' partner (away)
 	for(i = 0; i < PLAYERS_PER_TEAM; i++)
 		for(j = i + 1; j < PLAYERS_PER_TEAM; j++) {
 			unsigned int p1 = court->team_away.team_players[i];
 			unsigned int p2 = court->team_away.team_players[j];
-			set_played_together(court->tm->tm_data->pt, p1, p2);
+			set_played_together(court->tm->pt, p1, p2);
 			}
 }
 
 /* Auxiliar function that receives a MSG_PLAYER_JOIN_REQ message
- * for court and determinates if that player can join or not. If
- * the player can join the match, this functions accepts them and
- * assign them a team. If the player can't, this function should
- * kick them off!*/
+ * for court and determinates if that player can join or not. A
+ * player is accepted as long as the four players can still be
+ * split in two teams of players who never played together; once
+ * the fourth one is in, the court picks one of those splits. If
+ * the player can't join, this function should kick them off!*/
 void handle_player_team(message_t msg){
 	court_t* court = court_get_instance();
 	static int join_attempts = 0;
-	switch(court->connected_players){
-		case 0: // First player to connect. Instantly accepted on team 0
-			connect_player_in_team(msg.m_player_id, 0);
-			join_attempts = 0; // Question for the reader: why is this line important?
-			break;
-		case 1: // Second player to connect.
-			// If can team up with first player, let them do it
-			if(court_team_player_can_join_team(court->team_home ,msg.m_player_id, court->tm->tm_data->pt))
-				connect_player_in_team(msg.m_player_id, 0);
-			else // If not, go to other team
-				connect_player_in_team(msg.m_player_id, 1);
-			break;
-		default:
-			if(court->connected_players >= PLAYERS_PER_MATCH){
-				// Should not happen
-				log_write(CRITICAL_L, "Court %03d: Wrong value for court->connected_players: %d\n", court->court_id, court->connected_players);
-				break; 
-				}
-			
-			// Check if can join team0
-			if(court_team_player_can_join_team(court->team_home ,msg.m_player_id, court->tm->tm_data->pt))
-				connect_player_in_team(msg.m_player_id, 0);
-			// Check if can join team1
-			else if(court_team_player_can_join_team(court->team_away ,msg.m_player_id, court->tm->tm_data->pt))
-				connect_player_in_team(msg.m_player_id, 1);
-			else // kick player
-				reject_player(msg.m_player_id);
-		}
+	if(court->connected_players >= PLAYERS_PER_MATCH){
+		// Should not happen
+		log_write(CRITICAL_L, "Court %03d: Wrong value for court->connected_players: %d\n", court->court_id, court->connected_players);
+		return;
+	}
+	if(court->connected_players == 0)
+		join_attempts = 0; // Question for the reader: why is this line important?
+
+	unsigned int ids[PLAYERS_PER_MATCH];
+	size_t n = court->connected_players;
+	memcpy(ids, court->candidates, sizeof(unsigned int) * n);
+	ids[n++] = msg.m_player_id;
+
+	bool can_join = true;
+	unsigned int splits = 0;
+	if(n == PLAYERS_PER_MATCH - 1) {
+		// The last one may pair up with anybody, so a single
+		// allowed pair among these three is enough
+		can_join = (partners_table_allowed_pairs(court->tm->pt, ids, n) != 0);
+	} else if(n == PLAYERS_PER_MATCH) {
+		splits = partners_table_valid_splits(court->tm->pt, ids);
+		can_join = (splits != 0);
+	}
+
+	if(can_join) {
+		court_accept_candidate(msg.m_player_id);
+		if(n == PLAYERS_PER_MATCH)
+			court_form_teams(court_pick_split(ids, splits));
+	} else // kick player
+		reject_player(msg.m_player_id);
 		
 	join_attempts++;
 	if(join_attempts == JOIN_ATTEMPTS_MAX) {
@@ -384,14 +542,123 @@ void handle_player_team(message_t msg){
 }
 
 
+/* Checkpoints the match on course, which the tide is about
+ * to interrupt, so that its players can finish it later.*/
+void court_suspend_match(){
+	court_t* court = court_get_instance();
+	uint8_t sets_won[2] = {court->team_home.sets_won, court->team_away.sets_won};
+	lock_acquire(court->tm->tm_lock);
+	int sm = tournament_suspend_match(court->tm, court->candidates, sets_won, court->court_id);
+	lock_release(court->tm->tm_lock);
+	if (sm < 0)
+		log_write(ERROR_L, "Court %03d: No room to keep the flooded match, it's lost\n", court->court_id);
+	else
+		log_write(INFO_L, "Court %03d: Match suspended by the tide (%d - %d), kept for later\n", court->court_id, sets_won[0], sets_won[1]);
+}
+
+/* Returns true if this court claimed a suspended match, and
+ * is waiting for its players. In that case, the match is
+ * copied to m (checked and read under the same lock, as
+ * players leaving drop it in the meantime).*/
+bool court_resume_claimed(suspended_match_t* m){
+	court_t* court = court_get_instance();
+	tournament_t* tm = court->tm;
+	lock_acquire(tm->tm_lock);
+	int claimed = tm->tm_data->tm_courts[court->court_id].court_resume;
+	if (claimed >= 0)
+		*m = tm->tm_data->tm_suspended[claimed];
+	lock_release(tm->tm_lock);
+	return (claimed >= 0);
+}
+
+/* Returns true if the received player is on a suspended match.
+ * Such a player only comes to the court claiming it, so they
+ * came for a match another court holds now (this one lost it
+ * to the tide before they got here).*/
+bool court_player_suspended(unsigned int p_id){
+	court_t* court = court_get_instance();
+	lock_acquire(court->tm->tm_lock);
+	bool suspended = (court->tm->tm_data->tm_players_state[p_id].player_suspended >= 0);
+	lock_release(court->tm->tm_lock);
+	return suspended;
+}
+
+/* Checks if the suspended match this court claimed was dropped
+ * (one of its players left). If so, whoever came for it is
+ * kicked, and the court is free again. Returns true in that case.*/
+bool court_resume_dropped(){
+	court_t* court = court_get_instance();
+	lock_acquire(court->tm->tm_lock);
+	bool dropped = (TM_COURT_STATUS(court->tm, court->court_id) == TM_C_LOBBY)
+		&& (court->tm->tm_data->tm_courts[court->court_id].court_resume < 0);
+	lock_release(court->tm->tm_lock);
+	if (dropped) {
+		log_write(INFO_L, "Court %03d: Suspended match was dropped\n", court->court_id);
+		kick_all_players(true);
+	}
+	return dropped;
+}
+
+/* Takes the received player on the lobby, for the suspended match
+ * this court claimed (m, as returned by court_resume_claimed). Once
+ * the four of them are in, teams and sets won are restored as they
+ * were when the tide came.*/
+void handle_player_resume(message_t msg, suspended_match_t m){
+	court_t* court = court_get_instance();
+	tournament_t* tm = court->tm;
+
+	int i, slot = -1;
+	for (i = 0; i < PLAYERS_PER_MATCH; i++)
+		if (m.sm_players[i] == msg.m_player_id) slot = i;
+	if (slot < 0) {
+		// Shouldn't happen: nobody else picks this court
+		reject_player(msg.m_player_id);
+		return;
+	}
+	court_accept_candidate(msg.m_player_id);
+	if (court->connected_players < PLAYERS_PER_MATCH)
+		return;
+
+	// Put everyone back on the slot they had
+	unsigned int ids[PLAYERS_PER_MATCH];
+	int fifos[PLAYERS_PER_MATCH];
+	int j;
+	for (i = 0; i < PLAYERS_PER_MATCH; i++)
+		for (j = 0; j < PLAYERS_PER_MATCH; j++)
+			if (court->candidates[j] == m.sm_players[i]) {
+				ids[i] = court->candidates[j];
+				fifos[i] = court->player_fifos[j];
+			}
+	court_team_initialize(&court->team_home);
+	court_team_initialize(&court->team_away);
+	for (i = 0; i < PLAYERS_PER_MATCH; i++) {
+		court->candidates[i] = ids[i];
+		court->player_fifos[i] = fifos[i];
+		court_team_join_player((i < PLAYERS_PER_TEAM ? &court->team_home : &court->team_away), ids[i]);
+	}
+	court->team_home.sets_won = m.sm_sets_won[0];
+	court->team_away.sets_won = m.sm_sets_won[1];
+	log_write(INFO_L, "Court %03d: Resuming match from court %03d (%d - %d): %03d & %03d VS %03d & %03d\n", court->court_id,
+			m.sm_flooded_court, m.sm_sets_won[0], m.sm_sets_won[1], ids[0], ids[1], ids[2], ids[3]);
+
+	uint64_t duration = court_predict_duration(ids, ids + PLAYERS_PER_TEAM);
+	court->match_started_at = latency_now();
+	lock_acquire(tm->tm_lock);
+	tournament_resume_match(tm, court->court_id);
+	tm->tm_data->tm_courts[court->court_id].court_predicted_end = court->match_started_at + duration;
+	lock_release(tm->tm_lock);
+}
+
 /* Auxiliar function that opens this court's fifo. If fifo was 
- * already opened, silently does nothing.
- * Watch out! open is blocking!*/
+ * already opened, silently does nothing. It's opened for writing
+ * too, so it never blocks and is kept open from match to match:
+ * a player who writes as the last match ends never finds it
+ * closed (and dies of SIGPIPE), their request just waits.*/
 void open_court_fifo(){
 	court_t* court = court_get_instance();
 	if (court->court_fifo < 0) {
 		log_write(DEBUG_L, "Court %03d: Court FIFO is closed, need to open one\n", court->court_id, errno);
-		int court_fifo = open(court->court_fifo_name, O_RDONLY);
+		int court_fifo = open_fifo(court->court_fifo_name, O_RDWR);
 		log_write(DEBUG_L, "Court %03d: Court FIFO opened!!!\n", court->court_id, errno);
 		if (court_fifo < 0) {
 			log_write(ERROR_L, "Court %03d: FIFO opening error [errno: %d]\n", court->court_id, errno);
@@ -419,15 +686,15 @@ court_t* court_create() {
 	court_team_initialize(&court->team_away);
 	court_team_initialize(&court->team_home);
 	court->connected_players = 0;
-	court->flooded = false;
+	for (i = 0; i < PLAYERS_PER_MATCH; i++)
+		court->candidates[i] = INVALID_PLAYER_ID;
+	court->flood = NULL;
 	return court;
 }
 
 /* Kills the received court and sends flowers to his widow.*/
 void court_destroy(){
 	court_t* court = court_get_instance();
-	partners_table_destroy(court->tm->tm_data->pt);
-	score_table_destroy(court->tm->tm_data->st);
 	tournament_destroy(court->tm);
 	free(court);
 	// Sry, no flowers
@@ -458,10 +725,11 @@ void court_lobby() {
 	court_team_initialize(&court->team_home);
 	court_team_initialize(&court->team_away);
 	message_t msg = {};
-	bool cut_condition = false;
+	suspended_match_t resume;
+	bool resuming = false;
 
 	while (court->connected_players < PLAYERS_PER_MATCH) {
-		if (court->flooded) {
+		if (court_is_flooded(court)) {
 			log_write(ERROR_L, "Court %03d: flooded on kicking everybody before semaphore\n", court->court_id);
 			kick_all_players(false);
 			return;
@@ -469,15 +737,34 @@ void court_lobby() {
 		
 		sem_wait(court->tm->tm_data->tm_courts_sem, court->court_id);
 
-		if (court->flooded) {
-			log_write(ERROR_L, "Court %03d: flooded on kicking everybody\n", court->court_id);
-			kick_all_players(false);
-			return;
-		}
-		
 		lock_acquire(court->tm->tm_lock);
-		int players_alive = court->tm->tm_data->tm_active_players;
+		bool woken = tournament_court_take_wakeup(court->tm, court->court_id);
 		lock_release(court->tm->tm_lock);
+		if (woken) {
+			// Not a player: either the tide came, or the tournament
+			// is ending, so whoever is waiting on the lobby leaves
+			if (court_is_flooded(court)) {
+				log_write(ERROR_L, "Court %03d: flooded on kicking everybody\n", court->court_id);
+				kick_all_players(false);
+				return;
+			}
+			// The tide may have come and gone before the court
+			// looked: whoever was waiting leaves all the same
+			if (court_flood_missed(court)) {
+				log_write(INFO_L, "Court %03d: Water came and went, kicking everybody\n", court->court_id);
+				kick_all_players(true);
+				return;
+			}
+			if (tournament_phase(court->tm) == TM_RUNNING) {
+				// The suspended match claimed was dropped
+				if (court_resume_dropped())
+					return;
+				continue;
+			}
+			if (court->connected_players > 0)
+				kick_all_players(false);
+			return;
+		}
 		// Now court is in the "empty" state, waiting for new connections
 		open_court_fifo(court);
 		log_write(INFO_L, "Court %03d: Court awaiting connections\n", court->court_id, errno);
@@ -499,27 +786,47 @@ void court_lobby() {
 					log_write(ERROR_L, "Court %03d: FIFO opening error for player %d fifo [errno: %d]\n", court->court_id, msg.m_player_id, errno);
 					return;
 				}
-				court->player_fifos[court->connected_players] = open(player_fifo_name, O_WRONLY);
+				court->player_fifos[court->connected_players] = open_fifo(player_fifo_name, O_WRONLY);
 				if (court->player_fifos[court->connected_players] < 0) {
 					log_write(ERROR_L, "Court %03d: FIFO opening error for player %d fifo [errno: %d]\n", court->court_id, msg.m_player_id, errno);
 				} else {
-					log_write(INFO_L, "Court %03d: Court will handle player %d\n", court->court_id, msg.m_player_id);
-					handle_player_team(msg);
+					if (court_is_flooded(court)) {
+						log_write(INFO_L, "Court %03d: Court is flooded, no match for player %d\n", court->court_id, msg.m_player_id);
+						reject_player(msg.m_player_id);
+					} else if (tournament_phase(court->tm) != TM_RUNNING) {
+						log_write(INFO_L, "Court %03d: Tournament is ending, no new matches for player %d\n", court->court_id, msg.m_player_id);
+						reject_player(msg.m_player_id);
+					} else if (court_resume_claimed(&resume)) {
+						log_write(INFO_L, "Court %03d: Court will resume a match with player %d\n", court->court_id, msg.m_player_id);
+						resuming = true;
+						handle_player_resume(msg, resume);
+					} else if (resuming) {
+						// The match being resumed was dropped after some
+						// of its players came back. They're kicked on the
+						// wake up the drop sent, and so is this one
+						log_write(INFO_L, "Court %03d: Suspended match was dropped, no match for player %d\n", court->court_id, msg.m_player_id);
+						reject_player(msg.m_player_id);
+					} else if (court_player_suspended(msg.m_player_id)) {
+						// Otherwise their match, elsewhere, would wait
+						// for them forever
+						log_write(INFO_L, "Court %03d: Player %d's suspended match moved to another court\n", court->court_id, msg.m_player_id);
+						reject_player(msg.m_player_id);
+					} else {
+						log_write(INFO_L, "Court %03d: Court will handle player %d\n", court->court_id, msg.m_player_id);
+						handle_player_team(msg);
+					}
 				}
 			}
 		}
 	}
 	
-	if (!court->flooded) {
+	if (!court_is_flooded(court)) {
 		court_play(court);
 	} else {
 		log_write(ERROR_L, "Court %03d: Flooded before starting match\n", court->court_id);
 		kick_all_players(court);
 	}
 
-	if (court->court_fifo >= 0)
-		close(court->court_fifo);
-	court->court_fifo = -1;
 	int i;
 	for (i = 0; i < PLAYERS_PER_MATCH; i++) {
 		court->player_fifos[i] = -1;
@@ -535,51 +842,60 @@ void court_play(){
 	court_t* court = court_get_instance();
 	int i, j;
 	unsigned long int players_scores[PLAYERS_PER_MATCH] = {0};
-	message_t msg = {};
 
-	// Play SETS_AMOUNT sets
-	for (j = 0; j < SETS_AMOUNT; j++) {
+	uint64_t t_start;
+
+	// Play SETS_AMOUNT sets (a resumed match goes on from
+	// the sets already played)
+	for (j = court->team_home.sets_won + court->team_away.sets_won; j < SETS_AMOUNT; j++) {
 
-		if (court->flooded) {
-			court_finish_set();
+		if (court_is_flooded(court)) {
+			court_suspend_match();
 			kick_all_players(false);
 			return;
 		}
 
-		msg.m_type = MSG_SET_START;
+		t_start = latency_now();
 
 		log_write(INFO_L, "Court %03d: Set %d started!\n", court->court_id, j+1);
-		// Here we make the four players play a set by  
-		// sending them a message through the pipe.  
-		// Change later for a better message protocol.
-		for (i = 0; i < PLAYERS_PER_MATCH; i++) {
-			send_msg(court->player_fifos[i], &msg);
-		}
+		// Here we make the four players play a set
+		broadcast_send(court_broadcast(court), MSG_SET_START, 0);
 		
 		// Let the set last 6 seconds for now. After that, the
 		// main process will make all players stop
-		unsigned long int t_rand = rand() % (SET_MAX_DURATION - SET_MIN_DURATION);
-		usleep(t_rand + SET_MIN_DURATION);
+		const tuning_t* tn = court->tm->tuning;
+		unsigned long int t_rand = rand() % (tn->set_max - tn->set_min);
+		court_wait_set(court, t_rand + tn->set_min);
 
-		if (court->flooded) {
-			court_finish_set();
+		if (court_is_flooded(court)) {
+			court_suspend_match();
 			kick_all_players(false);
 			return;
 		}
 		
-		court_finish_set(court);
+		court_finish_set();
+		latency_record(court->tm->lt, LAT_SET_DURATION, t_start);
 		
-		// Wait for the four player's scores
-		for (i = 0; i < PLAYERS_PER_MATCH; i++){
-			if(!receive_msg(court->court_fifo, &msg)) {
-				log_write(ERROR_L, "Court %03d: Error reading score from player %03d [errno: %d]\n", court->court_id, i, errno);
-			} else {
-				log_write(DEBUG_L, "Court %03d: Received %d from player %03d\n", court->court_id, msg.m_type, msg.m_player_id);
-				assert(msg.m_type == MSG_PLAYER_SCORE);
-				int pc_id = court_player_to_court_id(msg.m_player_id);
-				players_scores[pc_id] = msg.m_score;
+		// Wait for the four player's scores, taking at once
+		// as many as were already sent
+		t_start = latency_now();
+		message_t scores[PLAYERS_PER_MATCH];
+		int got = 0;
+		while (got < PLAYERS_PER_MATCH) {
+			int r = receive_msgs(court->court_fifo, scores, PLAYERS_PER_MATCH - got);
+			if (r < 0) {
+				log_write(ERROR_L, "Court %03d: Error reading scores, %d of %d received [errno: %d]\n", court->court_id, got, PLAYERS_PER_MATCH, errno);
+				break;
 			}
+			for (i = 0; i < r; i++) {
+				log_write(DEBUG_L, "Court %03d: Received %d from player %03d\n", court->court_id, scores[i].m_type, scores[i].m_player_id);
+				assert(scores[i].m_type == MSG_PLAYER_SCORE);
+				int pc_id = court_player_to_court_id(scores[i].m_player_id);
+				players_scores[pc_id] = scores[i].m_score;
+			}
+			got += r;
 		}
+		latency_record(court->tm->lt, LAT_SCORE_COLLECT, t_start);
 		// Show this set score
 		for(i = 0; i < PLAYERS_PER_MATCH; i++) {
 			int p_id = court_court_id_to_player(i);
@@ -608,50 +924,51 @@ void court_play(){
 			break;	
 	}
 
-	// Here we make the players stop the match
+	// Done writing to the players: their fifos are closed before
+	// they leave, or a player opening theirs for the next match
+	// could see this end close and read an EOF as the reply
 	for (i = 0; i < PLAYERS_PER_MATCH; i++) {
-		if (court->flooded)
-			msg.m_type = MSG_MATCH_END;
-		else
-			msg.m_type = MSG_MATCH_END;
-		send_msg(court->player_fifos[i], &msg);
+		if (court->player_fifos[i] >= 0)
+			close(court->player_fifos[i]);
+		court->player_fifos[i] = -1;
 	}
 
+	// Here we make the players stop the match
+	broadcast_send(court_broadcast(court), MSG_MATCH_END, PLAYERS_PER_MATCH);
+
 
 	// Here we update the tournament info to set the court free
 	lock_acquire(court->tm->tm_lock);
-	if (!court->flooded)
-		court->tm->tm_data->tm_courts[court->court_id].court_status = TM_C_FREE;
-	court->tm->tm_data->tm_courts[court->court_id].court_num_players = 0;
+	TM_COURT_NUM_PLAYERS(court->tm, court->court_id) = 0;
+	court->tm->tm_data->tm_courts[court->court_id].court_predicted_end = 0;
 	for(i = 0; i < PLAYERS_PER_MATCH; i++)
 		court->tm->tm_data->tm_courts[court->court_id].court_players[i] = INVALID_PLAYER_ID;
+	if (!court_is_flooded(court))
+		tournament_court_freed(court->tm, court->court_id);
 	lock_release(court->tm->tm_lock);
 	
-	if (court->flooded) return;
+	if (court_is_flooded(court)) return;
+	log_write(INFO_L, "Court %03d: Match lasted %llu ms\n", court->court_id, (unsigned long long) ((latency_now() - court->match_started_at) / 1000));
 
+	t_start = latency_now();
 	update_player_match_data();
 	manage_players_scores();
 	mark_players_partners();
+	latency_record(court->tm->lt, LAT_POST_MATCH, t_start);
 }
 
-/* Finish the current set by signaling
- * the players with SIG_SET.*/
+/* Finish the current set by telling the players on
+ * the court's channel. Each of them answers with their
+ * score, which must be collected before broadcasting
+ * anything else (so they don't need to acknowledge it).*/
 void court_finish_set(){
 	court_t* court = court_get_instance();
-	int i;
-	for(i = 0; i < PLAYERS_PER_MATCH; i++){
-		int player_id = court_court_id_to_player(i);
-		if(player_id == INVALID_PLAYER_ID) break;
-		player_data_t pd = court->tm->tm_data->tm_players[player_id];
-		kill(pd.player_pid, SIG_SET);
-	}
+	broadcast_send(court_broadcast(court), MSG_SET_END, 0);
 }
 
 /* Executes main for this process. Finishes via exit(0)*/
 void court_main(unsigned int court_id, tournament_t* tm) {
 	court_t* court = court_get_instance();
-	court_set_termination_handler();
-	court_set_tide_handler();
 
 	if(!court)
 		exit(-1);
@@ -661,18 +978,29 @@ void court_main(unsigned int court_id, tournament_t* tm) {
 
 	lock_acquire(tm->tm_lock);
 	tm->tm_data->tm_courts[court_id].court_pid = getpid();
-	court->flood_sem = tm->tm_data->tm_courts_flood_sem;
+	court->flood = &tm->tm_data->tm_courts[court_id].court_flood;
 	lock_release(tm->tm_lock);
 		
 	log_write(DEBUG_L, "Court %03d: Launched using PID: %d\n", court->court_id, getpid());
 	get_court_fifo_name(court_id, court->court_fifo_name);
+	if(!create_fifo(court->court_fifo_name)) {
+		log_write(ERROR_L, "Court %03d: FIFO creation error [errno: %d]\n", court_id, errno);
+		exit(-1);
+	}
 
 	while(1){ 
-		if (court->flooded) {
+		if (court_is_flooded(court)) {
 			log_write(DEBUG_L, "Court %03d: It's flooded!! Waiting till water goes down\n", court_id);
-			sem_wait(court->flood_sem, court_id);
+			while (court_is_flooded(court))
+				futex_wait(court->flood, 1, 0);
 			log_write(DEBUG_L, "Court %03d: Water went down\n", court_id);
 		}
+		// Every player is gone: time to leave
+		if (tournament_phase(tm) == TM_ENDED)
+			court_self_destruct();
+		// Only now the court is free again (the tide may have
+		// gone before it even noticed the water)
+		court_dry(court);
 
 		court_lobby(court);
 	}
@@ -38,12 +38,16 @@ typedef struct court_ {
 	char court_fifo_name[MAX_FIFO_NAME_LEN];
 	bool close_pipes; 
 
-	bool flooded;
-	int flood_sem;
+	// Court flood word on the tournament (see court_flood)
+	uint32_t* flood;
 
 	court_team_t team_home; // team 0
 	court_team_t team_away; // team 1
 	uint8_t connected_players;
+	// Players accepted on the lobby, in the same order as
+	// player_fifos. Teams are only formed once all are in.
+	unsigned int candidates[PLAYERS_PER_MATCH];
+	uint64_t match_started_at;
 	
 	tournament_t* tm;
 } court_t;
@@ -90,8 +94,10 @@ void court_destroy();
 void court_play();
 void court_lobby();
 
-/* Finish the current set by signaling
- * the players with SIG_SET.*/
+/* Finish the current set by telling the players on
+ * the court's channel. Each of them answers with their
+ * score, which must be collected before broadcasting
+ * anything else.*/
 void court_finish_set();
 
 /* Returns a number between 0 and PLAYERS_PER_MATCH -1 which 
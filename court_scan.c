@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "log.h"
+#include "tournament.h"
+#include "court_scan.h"
+
+#if COURT_SCAN_SIMD && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define COURT_SCAN_X86 1
+#include <immintrin.h>
+#else
+#define COURT_SCAN_X86 0
+#endif
+
+typedef int (*court_scan_kernel)(const uint8_t*, const uint8_t*, size_t);
+
+/* Auxiliar function that returns the scan key of a court:
+ * players inside plus one if it's free and not full, 0
+ * otherwise.*/
+static inline uint8_t court_scan_key(uint8_t status, uint8_t num_players){
+	return ((status == TM_C_FREE) && (num_players < PLAYERS_PER_MATCH)) ? (num_players + 1) : 0;
+}
+
+/* Auxiliar function that returns the highest key on courts
+ * [from, to), starting from best.*/
+static uint8_t court_scan_max_key(const uint8_t* status, const uint8_t* num_players, size_t from, size_t to, uint8_t best){
+	size_t i;
+	for(i = from; i < to; i++) {
+		uint8_t key = court_scan_key(status[i], num_players[i]);
+		if(key > best) best = key;
+	}
+	return best;
+}
+
+/* Auxiliar function that returns the first court on
+ * [from, to) holding key, or -1 if none does.*/
+static int court_scan_find_key(const uint8_t* status, const uint8_t* num_players, size_t from, size_t to, uint8_t key){
+	size_t i;
+	for(i = from; i < to; i++)
+		if(court_scan_key(status[i], num_players[i]) == key)
+			return (int) i;
+	return -1;
+}
+
+#if (!COURT_SCAN_X86) || COURT_SCAN_CHECK
+
+/* Scalar kernel, used when there's no SIMD available (and
+ * to check the SIMD kernels, if COURT_SCAN_CHECK is set).*/
+static int court_scan_scalar(const uint8_t* status, const uint8_t* num_players, size_t courts){
+	uint8_t best = court_scan_max_key(status, num_players, 0, courts, 0);
+	if(best == 0) return -1;
+	return court_scan_find_key(status, num_players, 0, courts, best);
+}
+
+#endif
+
+#if COURT_SCAN_X86
+
+/* Auxiliar function that returns the scan keys of 16 courts
+ * (see court_scan_key).*/
+static inline __m128i court_scan_keys_sse2(__m128i st_v, __m128i np_v){
+	const __m128i free_v = _mm_set1_epi8(TM_C_FREE);
+	const __m128i room_v = _mm_set1_epi8(PLAYERS_PER_MATCH - 1);
+	const __m128i one_v = _mm_set1_epi8(1);
+	// Unsigned np <= room, as np == min(np, room)
+	__m128i has_room = _mm_cmpeq_epi8(_mm_min_epu8(np_v, room_v), np_v);
+	__m128i open = _mm_and_si128(_mm_cmpeq_epi8(st_v, free_v), has_room);
+	return _mm_and_si128(open, _mm_add_epi8(np_v, one_v));
+}
+
+/* SSE2 kernel: 16 courts per step. A first pass gets the
+ * highest key, a second one stops at the first court with it.*/
+static int court_scan_sse2(const uint8_t* status, const uint8_t* num_players, size_t courts){
+	size_t blocks = courts & ~((size_t) 15);
+	__m128i best_v = _mm_setzero_si128();
+	size_t i;
+
+	for(i = 0; i < blocks; i += 16) {
+		__m128i st_v = _mm_loadu_si128((const __m128i*) (status + i));
+		__m128i np_v = _mm_loadu_si128((const __m128i*) (num_players + i));
+		__m128i keys = court_scan_keys_sse2(st_v, np_v);
+		best_v = _mm_max_epu8(best_v, keys);
+	}
+	uint8_t lanes[16];
+	_mm_storeu_si128((__m128i*) lanes, best_v);
+	uint8_t best = 0;
+	for(i = 0; i < 16; i++)
+		if(lanes[i] > best) best = lanes[i];
+	best = court_scan_max_key(status, num_players, blocks, courts, best);
+	if(best == 0) return -1;
+
+	const __m128i target_v = _mm_set1_epi8((char) best);
+	for(i = 0; i < blocks; i += 16) {
+		__m128i st_v = _mm_loadu_si128((const __m128i*) (status + i));
+		__m128i np_v = _mm_loadu_si128((const __m128i*) (num_players + i));
+		__m128i keys = court_scan_keys_sse2(st_v, np_v);
+		int hits = _mm_movemask_epi8(_mm_cmpeq_epi8(keys, target_v));
+		if(hits)
+			return (int) i + __builtin_ctz(hits);
+	}
+	return court_scan_find_key(status, num_players, blocks, courts, best);
+}
+
+/* Auxiliar function that returns the scan keys of 32 courts
+ * (see court_scan_key).*/
+__attribute__((target("avx2")))
+static inline __m256i court_scan_keys_avx2(__m256i st_v, __m256i np_v){
+	const __m256i free_v = _mm256_set1_epi8(TM_C_FREE);
+	const __m256i room_v = _mm256_set1_epi8(PLAYERS_PER_MATCH - 1);
+	const __m256i one_v = _mm256_set1_epi8(1);
+	__m256i has_room = _mm256_cmpeq_epi8(_mm256_min_epu8(np_v, room_v), np_v);
+	__m256i open = _mm256_and_si256(_mm256_cmpeq_epi8(st_v, free_v), has_room);
+	return _mm256_and_si256(open, _mm256_add_epi8(np_v, one_v));
+}
+
+/* AVX2 kernel: same as the SSE2 one, 32 courts per step.*/
+__attribute__((target("avx2")))
+static int court_scan_avx2(const uint8_t* status, const uint8_t* num_players, size_t courts){
+	size_t blocks = courts & ~((size_t) 31);
+	__m256i best_v = _mm256_setzero_si256();
+	size_t i;
+
+	for(i = 0; i < blocks; i += 32) {
+		__m256i st_v = _mm256_loadu_si256((const __m256i*) (status + i));
+		__m256i np_v = _mm256_loadu_si256((const __m256i*) (num_players + i));
+		__m256i keys = court_scan_keys_avx2(st_v, np_v);
+		best_v = _mm256_max_epu8(best_v, keys);
+	}
+	uint8_t lanes[32];
+	_mm256_storeu_si256((__m256i*) lanes, best_v);
+	uint8_t best = 0;
+	for(i = 0; i < 32; i++)
+		if(lanes[i] > best) best = lanes[i];
+	best = court_scan_max_key(status, num_players, blocks, courts, best);
+	if(best == 0) return -1;
+
+	const __m256i target_v = _mm256_set1_epi8((char) best);
+	for(i = 0; i < blocks; i += 32) {
+		__m256i st_v = _mm256_loadu_si256((const __m256i*) (status + i));
+		__m256i np_v = _mm256_loadu_si256((const __m256i*) (num_players + i));
+		__m256i keys = court_scan_keys_avx2(st_v, np_v);
+		unsigned int hits = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(keys, target_v));
+		if(hits)
+			return (int) i + __builtin_ctz(hits);
+	}
+	return court_scan_find_key(status, num_players, blocks, courts, best);
+}
+
+#endif
+
+/* Auxiliar function that picks the best kernel
+ * this machine can run.*/
+static court_scan_kernel court_scan_select(const char** name){
+#if COURT_SCAN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		*name = "avx2";
+		return court_scan_avx2;
+	}
+	*name = "sse2";
+	return court_scan_sse2;
+#else
+	*name = "scalar";
+	return court_scan_scalar;
+#endif
+}
+
+static court_scan_kernel kernel = NULL;
+static const char* kernel_name = NULL;
+
+/* Returns the index of the free court with the most players
+ * inside (the lowest index on ties) among the first courts
+ * ones, or -1 if no court is free. Arrays must hold at least
+ * courts bytes each. The caller has to hold the tournament
+ * lock so that the state doesn't change mid scan.*/
+int court_scan_best_free(const uint8_t* status, const uint8_t* num_players, size_t courts){
+	if((!status) || (!num_players)) return -1;
+	if(!kernel)
+		kernel = court_scan_select(&kernel_name);
+	int best = kernel(status, num_players, courts);
+#if COURT_SCAN_X86 && COURT_SCAN_CHECK
+	int expected = court_scan_scalar(status, num_players, courts);
+	if(best != expected)
+		log_write(ERROR_L, "Court scan: %s kernel picked %d, scalar loop picked %d\n", kernel_name, best, expected);
+#endif
+	return best;
+}
+
+/* Returns the name of the kernel court_scan_best_free
+ * uses on this machine, for logging purposes.*/
+const char* court_scan_kernel_name(){
+	if(!kernel)
+		kernel = court_scan_select(&kernel_name);
+	return kernel_name;
+}
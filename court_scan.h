@@ -0,0 +1,38 @@
+#ifndef COURT_SCAN_H
+#define COURT_SCAN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Set this flag to scan courts with SIMD instructions (SSE2, or
+// AVX2 if the CPU has it); clear it to always use the scalar loop
+#define COURT_SCAN_SIMD 1
+
+// Set this flag to check every SIMD scan against the scalar loop,
+// logging an error on any mismatch (slow, for testing kernels)
+#define COURT_SCAN_CHECK 0
+
+/*
+ * Court scans run over the court state kept as a structure of
+ * arrays: one status byte and one player count byte per court.
+ * Each court gets a key, which is its amount of players plus one
+ * if it's free and has room left, or 0 otherwise; the best court
+ * is the first one holding the highest key. That's two byte
+ * compares, an add, two ands and a max per court, so 16 or 32
+ * courts go per instruction.
+ */
+
+/* Returns the index of the free court with the most players
+ * inside (the lowest index on ties) among the first courts
+ * ones, or -1 if no court is free. A full court is never picked,
+ * even if marked as free. Arrays must hold at least
+ * courts bytes each. The caller has to hold the tournament
+ * lock so that the state doesn't change mid scan.*/
+int court_scan_best_free(const uint8_t* status, const uint8_t* num_players, size_t courts);
+
+/* Returns the name of the kernel court_scan_best_free
+ * uses on this machine, for logging purposes.*/
+const char* court_scan_kernel_name();
+
+#endif
@@ -0,0 +1,37 @@
+#include "futex.h"
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Sleeps while *word holds expected, for at most usec
+ * microseconds (0 means no limit). Returns 0 when woken up,
+ * negative otherwise: errno is EAGAIN if the word did not
+ * hold expected, ETIMEDOUT if the time ran out or EINTR if a
+ * signal arrived. Callers should check the word again anyway.
+ */
+int futex_wait(uint32_t* word, uint32_t expected, unsigned long int usec) {
+	struct timespec ts = {usec / 1000000, (usec % 1000000) * 1000};
+	return syscall(SYS_futex, word, FUTEX_WAIT, expected, (usec ? &ts : NULL), NULL, 0);
+}
+
+/*
+ * Same as futex_wait, but sleeps until deadline: an absolute
+ * CLOCK_MONOTONIC time in microseconds (as latency_now gives).
+ * Time spent waking up or retrying doesn't push it further.
+ */
+int futex_wait_until(uint32_t* word, uint32_t expected, uint64_t deadline) {
+	struct timespec ts = {deadline / 1000000, (deadline % 1000000) * 1000};
+	return syscall(SYS_futex, word, FUTEX_WAIT_BITSET, expected, &ts, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/*
+ * Wakes up to max processes sleeping on word (INT_MAX for
+ * all of them). Returns the amount woken, negative on error.
+ */
+int futex_wake(uint32_t* word, int max) {
+	return syscall(SYS_futex, word, FUTEX_WAKE, max, NULL, NULL, 0);
+}
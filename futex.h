@@ -0,0 +1,17 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+#include <stdint.h>
+
+/*
+ * Futexes on shared memory words. Unlike the semaphores, waking
+ * doesn't depend on a count: a process sleeps while the word
+ * holds an expected value, and whoever changes it wakes the
+ * sleepers up. Words must live on memory shared by all sides.
+ */
+
+// Operations
+int futex_wait(uint32_t* word, uint32_t expected, unsigned long int usec);
+int futex_wait_until(uint32_t* word, uint32_t expected, uint64_t deadline);
+int futex_wake(uint32_t* word, int max);
+
+#endif // FUTEX_H
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "log.h"
+#include "latency_table.h"
+
+/* Auxiliar function that maps a value to its bucket index.*/
+size_t latency_bucket_index(uint64_t value){
+	if(value < LAT_SUB_BUCKETS)
+		return (size_t) value;
+	int msb = 63 - __builtin_clzll(value);
+	size_t magnitude = msb - LAT_SUB_BITS + 1;
+	if(magnitude > LAT_MAGNITUDES)
+		return LAT_BUCKETS - 1;
+	size_t sub = (value >> (msb - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1);
+	return magnitude * LAT_SUB_BUCKETS + sub;
+}
+
+/* Auxiliar function that returns the highest value that
+ * falls on the bucket with the received index.*/
+uint64_t latency_bucket_top(size_t index){
+	size_t magnitude = index / LAT_SUB_BUCKETS;
+	uint64_t sub = index % LAT_SUB_BUCKETS;
+	if(magnitude == 0)
+		return sub;
+	uint64_t low = (LAT_SUB_BUCKETS + sub) << (magnitude - 1);
+	return low + (1ULL << (magnitude - 1)) - 1;
+}
+
+/* Returns the amount of shared memory a latency_table needs.*/
+size_t latency_table_shm_size(){
+	return sizeof(latency_histogram_t) * LAT_PHASES_AMOUNT;
+}
+
+/* Dinamically allocates a new latency_table, with every
+ * histogram empty, placing its data at shm (which must be
+ * shared memory of latency_table_shm_size bytes). Returns
+ * NULL on error.*/
+latency_table_t* latency_table_create(void* shm){
+	latency_table_t* lt = latency_table_attach(shm);
+	if(!lt) return NULL;
+
+	// Initialize histograms
+	memset(lt->hist, 0, latency_table_shm_size());
+	int i;
+	for(i = 0; i < LAT_PHASES_AMOUNT; i++)
+		lt->hist[i].min = UINT64_MAX;
+
+	return lt;
+}
+
+/* Dinamically allocates a new handle for the latency_table
+ * already created at shm, leaving its data untouched.
+ * Returns NULL on error.*/
+latency_table_t* latency_table_attach(void* shm){
+	if(!shm) return NULL;
+
+	latency_table_t* lt = malloc(sizeof(latency_table_t));
+	if(!lt) return NULL;
+
+	lt->hist = (latency_histogram_t*) shm;
+	return lt;
+}
+
+/* Destroys the allocated latency_table. Its shared memory
+ * belongs to whoever provided it, so it is left as is.*/
+void latency_table_destroy(latency_table_t* lt){
+	if(!lt) return;
+	free(lt);
+}
+
+/* Returns a monotonic timestamp in microseconds, meant
+ * to be used as the start mark for latency_record.*/
+uint64_t latency_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Records on phase's histogram the time elapsed since
+ * start. If lt is NULL, silently does nothing.*/
+void latency_record(latency_table_t* lt, latency_phase phase, uint64_t start){
+	if((!lt) || (phase >= LAT_PHASES_AMOUNT)) return;
+	uint64_t value = latency_now() - start;
+	latency_histogram_t* h = &lt->hist[phase];
+
+	__sync_fetch_and_add(&h->buckets[latency_bucket_index(value)], 1);
+	__sync_fetch_and_add(&h->sum, value);
+	__sync_fetch_and_add(&h->count, 1);
+
+	// Min and max are updated with a CAS loop
+	uint64_t seen = h->min;
+	while(value < seen)
+		seen = __sync_val_compare_and_swap(&h->min, seen, value);
+	seen = h->max;
+	while(value > seen)
+		seen = __sync_val_compare_and_swap(&h->max, seen, value);
+}
+
+/* Returns the value (in microseconds) below which pct percent
+ * of phase's samples fall, or 0 if there are no samples.*/
+uint64_t latency_percentile(latency_table_t* lt, latency_phase phase, double pct){
+	if((!lt) || (phase >= LAT_PHASES_AMOUNT)) return 0;
+	latency_histogram_t* h = &lt->hist[phase];
+	uint64_t count = h->count;
+	if(count == 0) return 0;
+
+	uint64_t wanted = (uint64_t) ((pct / 100.0) * count + 0.5);
+	if(wanted == 0) wanted = 1;
+	uint64_t seen = 0;
+	size_t i;
+	for(i = 0; i < LAT_BUCKETS; i++){
+		seen += h->buckets[i];
+		if(seen >= wanted) {
+			uint64_t top = latency_bucket_top(i);
+			return (top < h->max ? top : h->max);
+		}
+	}
+	return h->max;
+}
+
+/* Print every histogram summary on log. As reading is lock
+ * free, it can be called at any time by any process.*/
+void latency_table_print(latency_table_t* lt){
+	if(!lt) return;
+	char* names[LAT_PHASES_AMOUNT] = {
+	"court search", "fifo open", "join reply",
+	"set duration", "score collect", "post match"
+	};
+
+	log_write(STAT_L, "Latency histograms (microseconds)\n");
+	int i;
+	for(i = 0; i < LAT_PHASES_AMOUNT; i++){
+		latency_histogram_t* h = &lt->hist[i];
+		unsigned long long count = h->count;
+		if(count == 0) {
+			log_write(STAT_L, "\t%-13s: no samples\n", names[i]);
+			continue;
+		}
+		log_write(STAT_L, "\t%-13s: n=%llu avg=%llu min=%llu p50=%llu p90=%llu p99=%llu max=%llu\n",
+				names[i], count, (unsigned long long) (h->sum / count),
+				(unsigned long long) h->min,
+				(unsigned long long) latency_percentile(lt, i, 50),
+				(unsigned long long) latency_percentile(lt, i, 90),
+				(unsigned long long) latency_percentile(lt, i, 99),
+				(unsigned long long) h->max);
+	}
+}
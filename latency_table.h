@@ -0,0 +1,79 @@
+#ifndef LATENCY_TABLE_H
+#define LATENCY_TABLE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Phases of a match whose latency is measured. Players
+ * record the first three, courts the last three.*/
+typedef enum latency_phase_ {
+	LAT_COURT_SEARCH,	// Scan for a free court (player_looking_for_court)
+	LAT_FIFO_OPEN,		// Each blocking FIFO open between player and court
+	LAT_JOIN_REPLY,		// From join request until accept/reject arrives
+	LAT_SET_DURATION,	// From MSG_SET_START until the set is finished
+	LAT_SCORE_COLLECT,	// The four score messages of a set
+	LAT_POST_MATCH,		// Match data, scores and partners bookkeeping
+	LAT_PHASES_AMOUNT
+} latency_phase;
+
+/* HDR-like log-linear buckets. Values (in microseconds) below
+ * LAT_SUB_BUCKETS get an exact bucket each; above that, every
+ * power of two is split into LAT_SUB_BUCKETS buckets, so any
+ * value is known with a relative error below 1/LAT_SUB_BUCKETS.*/
+#define LAT_SUB_BITS 4
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_MAGNITUDES 36	// Up to 2^40 us, way more than a tournament
+#define LAT_BUCKETS ((LAT_MAGNITUDES + 1) * LAT_SUB_BUCKETS)
+
+typedef struct latency_histogram_ {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[LAT_BUCKETS];
+} latency_histogram_t;
+
+/* Table of one histogram per phase, stored on shared
+ * memory. Updates are atomic, so no lock is needed for
+ * recording nor for reading it while the tournament runs.*/
+typedef struct latency_table_ {
+	latency_histogram_t* hist;
+} latency_table_t;
+
+/* Returns the amount of shared memory a latency_table needs.*/
+size_t latency_table_shm_size();
+
+/* Dinamically allocates a new latency_table, with every
+ * histogram empty, placing its data at shm (which must be
+ * shared memory of latency_table_shm_size bytes). Returns
+ * NULL on error.*/
+latency_table_t* latency_table_create(void* shm);
+
+/* Dinamically allocates a new handle for the latency_table
+ * already created at shm, leaving its data untouched.
+ * Returns NULL on error.*/
+latency_table_t* latency_table_attach(void* shm);
+
+/* Destroys the allocated latency_table. Its shared memory
+ * belongs to whoever provided it, so it is left as is.*/
+void latency_table_destroy(latency_table_t* lt);
+
+/* Returns a monotonic timestamp in microseconds, meant
+ * to be used as the start mark for latency_record.*/
+uint64_t latency_now();
+
+/* Records on phase's histogram the time elapsed since
+ * start. If lt is NULL, silently does nothing.*/
+void latency_record(latency_table_t* lt, latency_phase phase, uint64_t start);
+
+/* Returns the value (in microseconds) below which pct percent
+ * of phase's samples fall, or 0 if there are no samples.*/
+uint64_t latency_percentile(latency_table_t* lt, latency_phase phase, double pct);
+
+/* Print every histogram summary on log. As reading is lock
+ * free, it can be called at any time by any process.*/
+void latency_table_print(latency_table_t* lt);
+
+#endif
@@ -5,7 +5,99 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include "lock.h"
+#include "log.h"
+
+// Lock profiler, shared by every process. Check
+// lock_profiler_get_instance before using it.
+static lock_profiler_t* profiler = NULL;
+static bool profiler_tried = false;
+
+/* Auxiliar function that returns a monotonic timestamp
+ * in nanoseconds, for the lock profiler.*/
+uint64_t lock_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Auxiliar function that atomically adds a sample to a
+ * total and max pair of counters of the lock profiler.*/
+void lock_stats_add(uint64_t* total, uint64_t* max, uint64_t value){
+	__sync_fetch_and_add(total, value);
+	uint64_t seen = *max;
+	while(value > seen)
+		seen = __sync_val_compare_and_swap(max, seen, value);
+}
+
+/* Auxiliar function that waits for a profiler slot claimed
+ * by another process to be filled. Returns false if it wasn't
+ * after LOCK_PROF_READY_SPINS checks.*/
+bool lock_profiler_wait_ready(int* ready){
+	int spins;
+	for(spins = 0; spins < LOCK_PROF_READY_SPINS; spins++){
+		__sync_synchronize();
+		if(*ready)
+			return true;
+	}
+	return false;
+}
+
+/* Auxiliar function that returns the profiler slot for the
+ * lock with the received name, claiming a new one if it had
+ * none. Returns -1 if the profiler is full.*/
+int lock_profiler_lock_slot(lock_profiler_t* prof, char* name){
+	int i;
+	for(i = 0; i < LOCK_PROF_MAX_LOCKS; i++){
+		lock_prof_lock_t* l = &prof->locks[i];
+		if(__sync_bool_compare_and_swap(&l->claimed, 0, 1)) {
+			strncpy(l->name, name, MAX_LOCK_NAME_LEN - 1);
+			__sync_synchronize();
+			l->ready = 1;
+			return i;
+		}
+		// Claimed by someone else: wait till they name it
+		if(!lock_profiler_wait_ready(&l->ready))
+			continue;
+		if(strcmp(l->name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* Auxiliar function that returns the profiler slot for
+ * the call site of lock_slot at file:line, claiming a new
+ * one if it had none. Returns -1 if the profiler is full.*/
+int lock_profiler_site_slot(lock_profiler_t* prof, int lock_slot, const char* file, int line){
+	unsigned long hash = 5381;
+	const char* c;
+	for(c = file; *c; c++)
+		hash = hash * 33 + *c;
+	hash = hash * 33 + line;
+	hash = hash * 33 + lock_slot;
+
+	int i;
+	for(i = 0; i < LOCK_PROF_MAX_SITES; i++){
+		lock_prof_site_t* s = &prof->sites[(hash + i) % LOCK_PROF_MAX_SITES];
+		if(__sync_bool_compare_and_swap(&s->claimed, 0, 1)) {
+			s->lock_slot = lock_slot;
+			s->line = line;
+			strncpy(s->file, file, LOCK_PROF_FILE_LEN - 1);
+			__sync_synchronize();
+			s->ready = 1;
+			return (hash + i) % LOCK_PROF_MAX_SITES;
+		}
+		if(!lock_profiler_wait_ready(&s->ready))
+			continue;
+		if((s->line == line) && (s->lock_slot == lock_slot) && (strncmp(s->file, file, LOCK_PROF_FILE_LEN - 1) == 0))
+			return (hash + i) % LOCK_PROF_MAX_SITES;
+	}
+	return -1;
+}
 
 /* Creates a lock associated with lock_name
  * given. Returns NULL in case of error.*/
@@ -24,6 +116,10 @@ lock_t* lock_create(char* lock_name){
 	strcat(lock->name, lock_name);
 	strcat(lock->name, ".lock");
 	
+	// Profiler slot is looked up on first acquire
+	lock->prof_slot = -1;
+	lock->prof_site = -1;
+	
 	lock->fd = open(lock->name, LOCK_CREAT_FLAGS, LOCK_CREAT_PERMS);
 	if(lock->fd < 0) {
 		free(lock);
@@ -45,9 +141,45 @@ void lock_destroy(lock_t* lock){
  * Pre: the process ain't have the lock.
  * Post: the process has the lock, and no other process
  * acquire it until this process releases it.*/
-int lock_acquire(lock_t* lock){
+int lock_acquire_at(lock_t* lock, const char* file, int line){
+	lock_profiler_t* prof = lock_profiler_get_instance();
+	if(!prof) {
+		lock->fl.l_type = F_WRLCK;
+		return fcntl(lock->fd, F_SETLKW, &(lock->fl));
+	}
+
+	if(lock->prof_slot < 0) {
+		// Strip "locks/" and ".lock" from the lock file name
+		char name[MAX_LOCK_NAME_LEN];
+		strcpy(name, lock->name + strlen("locks/"));
+		name[strlen(name) - strlen(".lock")] = '\0';
+		lock->prof_slot = lock_profiler_lock_slot(prof, name);
+	}
+	// The call site is looked up before taking the lock, so
+	// that the lookup isn't counted as (nor adds to) hold time
+	int site = -1;
+	if(lock->prof_slot >= 0)
+		site = lock_profiler_site_slot(prof, lock->prof_slot, file, line);
+
+	uint64_t t_start = lock_now();
 	lock->fl.l_type = F_WRLCK;
-	return fcntl(lock->fd, F_SETLKW, &(lock->fl));
+	int r = fcntl(lock->fd, F_SETLKW, &(lock->fl));
+	lock->prof_acquired_at = lock_now();
+	lock->prof_site = site;
+	if(lock->prof_slot < 0)
+		return r;
+
+	uint64_t wait = lock->prof_acquired_at - t_start;
+	lock_prof_lock_t* l = &prof->locks[lock->prof_slot];
+	__sync_fetch_and_add(&l->stats.acquires, 1);
+	lock_stats_add(&l->stats.wait_total, &l->stats.wait_max, wait);
+
+	if(lock->prof_site >= 0) {
+		lock_prof_site_t* s = &prof->sites[lock->prof_site];
+		__sync_fetch_and_add(&s->stats.acquires, 1);
+		lock_stats_add(&s->stats.wait_total, &s->stats.wait_max, wait);
+	}
+	return r;
 }
 
 /* Releases the lock, allowing other processes to
@@ -56,6 +188,103 @@ int lock_acquire(lock_t* lock){
  * one with it.
  * Post: the process ain't have the lock.*/
 int lock_release(lock_t* lock){
+	lock_profiler_t* prof = lock_profiler_get_instance();
+	if(prof && (lock->prof_slot >= 0)) {
+		uint64_t hold = lock_now() - lock->prof_acquired_at;
+		lock_prof_lock_t* l = &prof->locks[lock->prof_slot];
+		lock_stats_add(&l->stats.hold_total, &l->stats.hold_max, hold);
+		if(lock->prof_site >= 0) {
+			lock_prof_site_t* s = &prof->sites[lock->prof_site];
+			lock_stats_add(&s->stats.hold_total, &s->stats.hold_max, hold);
+		}
+	}
 	lock->fl.l_type = F_UNLCK;
 	return fcntl(lock->fd, F_SETLK, &(lock->fl));
 }
+
+// ------------------------------------------------------------
+
+/* Retrieves lock profiler singleton instance, creating
+ * it on first call. Main process should call it before
+ * forking, so that every process shares the same one.
+ * Returns NULL if LOCK_PROFILING is off or on error.*/
+lock_profiler_t* lock_profiler_get_instance(){
+	// Check if there's profiler already (or it failed)
+	if(profiler || profiler_tried || (!LOCK_PROFILING))
+		return profiler;
+	profiler_tried = true;
+	// If not, create it
+	key_t key = ftok("makefile", 17);
+	if(key < 0) return NULL;
+	int shmid = shmget(key, sizeof(lock_profiler_t), IPC_CREAT | 0644);
+	if(shmid < 0) return NULL;
+	void* shm = shmat(shmid, NULL, 0);
+	if(shm == (void*) -1) return NULL;
+	profiler = (lock_profiler_t*) shm;
+	memset(profiler, 0, sizeof(lock_profiler_t));
+	return profiler;
+}
+
+/* Auxiliar function that logs one line of stats.*/
+void lock_stats_print(char* label, lock_stats_t* stats){
+	unsigned long long n = stats->acquires;
+	if(n == 0) return;
+	log_write(STAT_L, "\t%-32s acquires=%llu wait avg/max=%llu/%llu us hold avg/max=%llu/%llu us\n", label, n,
+			(unsigned long long) (stats->wait_total / n / 1000), (unsigned long long) (stats->wait_max / 1000),
+			(unsigned long long) (stats->hold_total / n / 1000), (unsigned long long) (stats->hold_max / 1000));
+}
+
+/* Prints the stats of every lock and call site on log.
+ * Sites are listed by lock, the most waited ones first.*/
+void lock_profiler_print(){
+	lock_profiler_t* prof = lock_profiler_get_instance();
+	if(!prof) return;
+	log_write(STAT_L, "Lock contention profile\n");
+
+	int i, j;
+	for(i = 0; i < LOCK_PROF_MAX_LOCKS; i++){
+		lock_prof_lock_t* l = &prof->locks[i];
+		if(!l->ready) continue;
+		// Copy the stats, as the log lock keeps on recording
+		lock_stats_t stats = l->stats;
+		char label[MAX_LOCK_NAME_LEN + 16];
+		sprintf(label, "[%s]", l->name);
+		lock_stats_print(label, &stats);
+
+		int order[LOCK_PROF_MAX_SITES];
+		uint64_t waits[LOCK_PROF_MAX_SITES];
+		int n = 0;
+		for(j = 0; j < LOCK_PROF_MAX_SITES; j++){
+			lock_prof_site_t* s = &prof->sites[j];
+			if((!s->ready) || (s->lock_slot != i)) continue;
+			// Insertion sort by total wait
+			int k = n++;
+			while((k > 0) && (waits[k - 1] < s->stats.wait_total)) {
+				order[k] = order[k - 1];
+				waits[k] = waits[k - 1];
+				k--;
+			}
+			order[k] = j;
+			waits[k] = s->stats.wait_total;
+		}
+		for(j = 0; j < n; j++){
+			lock_prof_site_t* s = &prof->sites[order[j]];
+			stats = s->stats;
+			sprintf(label, "  %s:%d", s->file, s->line);
+			lock_stats_print(label, &stats);
+		}
+	}
+}
+
+/* Destroys the lock profiler and its shared memory.
+ * Only main process should call it.*/
+void lock_profiler_free(){
+	lock_profiler_t* prof = lock_profiler_get_instance();
+	if(!prof) return;
+	key_t key = ftok("makefile", 17);
+	int shmid = shmget(key, 0, 0);
+	shmdt((void*) prof);
+	profiler = NULL;
+	if(shmid >= 0)
+		shmctl(shmid, IPC_RMID, NULL);
+}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include "lock.h"
@@ -12,6 +13,17 @@
 #define LOCK_CREAT_FLAGS (O_CREAT|O_WRONLY)
 #define LOCK_CREAT_PERMS 0777
 
+// Set this flag to record contention stats of every lock
+// on the lock profiler; clear it to leave locks untouched
+#define LOCK_PROFILING 0
+
+#define LOCK_PROF_MAX_LOCKS 8
+#define LOCK_PROF_MAX_SITES 64
+#define LOCK_PROF_FILE_LEN 24
+// Times a profiler slot claimed by another process is checked
+// before giving up on it (its process may have died mid claim)
+#define LOCK_PROF_READY_SPINS 1000000
+
 /*
  *			LOCK Naming convention
  *
@@ -21,13 +33,51 @@
  * 
  */
 
-/* Lock structure to implement our own beautiful lock.*/
+/* Lock structure to implement our own beautiful lock.
+ * The prof_* fields are only used by the lock profiler.*/
 typedef struct lock_ {
 	struct flock fl;
 	int fd;
 	char name[MAX_LOCK_NAME_LEN];
+
+	int prof_slot;
+	int prof_site;
+	uint64_t prof_acquired_at;
 } lock_t;
 
+/* Contention counters kept by the lock profiler, both
+ * per named lock and per call site. Times are in ns.*/
+typedef struct lock_stats_ {
+	uint64_t acquires;
+	uint64_t wait_total;
+	uint64_t wait_max;
+	uint64_t hold_total;
+	uint64_t hold_max;
+} lock_stats_t;
+
+typedef struct lock_prof_lock_ {
+	int claimed;
+	int ready;
+	char name[MAX_LOCK_NAME_LEN];
+	lock_stats_t stats;
+} lock_prof_lock_t;
+
+typedef struct lock_prof_site_ {
+	int claimed;
+	int ready;
+	int lock_slot;
+	int line;
+	char file[LOCK_PROF_FILE_LEN];
+	lock_stats_t stats;
+} lock_prof_site_t;
+
+/* Lock profiler, stored on shared memory so every
+ * process of the tournament records on the same table.*/
+typedef struct lock_profiler_ {
+	lock_prof_lock_t locks[LOCK_PROF_MAX_LOCKS];
+	lock_prof_site_t sites[LOCK_PROF_MAX_SITES];
+} lock_profiler_t;
+
 /* Creates a lock associated with lock_name
  * given. Returns NULL in case of error.*/
 lock_t* lock_create(char* lock_name);
@@ -39,8 +89,12 @@ void lock_destroy(lock_t* lock);
  * the current process until it can be obtained.
  * Pre: the process ain't have the lock.
  * Post: the process has the lock, and no other process
- * acquire it until this process releases it.*/
-int lock_acquire(lock_t* lock);
+ * acquire it until this process releases it.
+ * Use it through lock_acquire, so that the caller site
+ * gets recorded by the lock profiler.*/
+int lock_acquire_at(lock_t* lock, const char* file, int line);
+
+#define lock_acquire(lock) lock_acquire_at((lock), __FILE__, __LINE__)
 
 /* Releases the lock, allowing other processes to
  * acquire it.
@@ -48,4 +102,18 @@ int lock_acquire(lock_t* lock);
  * one with it.
  * Post: the process ain't have the lock.*/
 int lock_release(lock_t* lock);
+
+/* Retrieves lock profiler singleton instance, creating
+ * it on first call. Main process should call it before
+ * forking, so that every process shares the same one.
+ * Returns NULL if LOCK_PROFILING is off or on error.*/
+lock_profiler_t* lock_profiler_get_instance();
+
+/* Prints the stats of every lock and call site on log.*/
+void lock_profiler_print();
+
+/* Destroys the lock profiler and its shared memory.
+ * Only main process should call it.*/
+void lock_profiler_free();
+
 #endif
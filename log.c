@@ -102,7 +102,7 @@ int log_write(log_level lvl, char* msg, ... ){
 	lock_acquire(log->lock);
 	fflush(log->log_file);
 	
-	char time_str[10];
+	char time_str[16];
 	get_time_string(log, time_str);
 	
 	va_list args;
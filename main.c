@@ -11,6 +11,8 @@
 #include <errno.h>
 #include <assert.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <stdint.h>
 #include <time.h>
 #include <errno.h>
 #include "confparser.h"
@@ -23,11 +25,15 @@
 #include "semaphore.h"
 #include "score_table.h"
 #include "tournament.h"
+#include "court_scan.h"
 #include "tide.h"
+#include "latency_table.h"
+#include "zygote.h"
+#include "retry.h"
 
 /* Returns negative in case of error!*/
 int main_init(tournament_t* tm, struct conf sc){
-	srand(time(NULL));
+	srand(sc.seed ? (unsigned int) sc.seed : (unsigned int) time(NULL));
 	// Spawn log
 	if(log_write(NONE_L, "Main: Simulation started!\n") < 0){
 		printf("FATAL: No log could be opened!\n");
@@ -37,34 +43,8 @@ int main_init(tournament_t* tm, struct conf sc){
 	
 	log_write(INFO_L, "Main: Self pid is %d\n", getpid());
 	
-	// We want processes to ignore SIG_SET and
-	// SIG_TIDE signals unless we set it explicitily
-	signal(SIG_SET, SIG_IGN);
-	signal(SIG_TIDE, SIG_IGN);
-	signal(SIGTERM, SIG_IGN);
-	
-	// Create every player FIFO
-	int i;
-	for(i = 0; i < sc.players; i++){
-		char player_fifo_name[MAX_FIFO_NAME_LEN];
-		get_player_fifo_name(i, player_fifo_name);
-		// Create the fifo for the player.
-		if(!create_fifo(player_fifo_name)) {
-			log_write(ERROR_L, "Main: FIFO creation error for player %03d [errno: %d]\n", i, errno);
-			return -1;
-		}
-	}
-	
-	// Create every court FIFO
-	for(i = 0; i < (sc.rows * sc.cols); i++){
-		char court_fifo_name[MAX_FIFO_NAME_LEN];
-		get_court_fifo_name(i, court_fifo_name);
-		// Creating fifo for court
-		if(!create_fifo(court_fifo_name)) {
-			log_write(ERROR_L, "Main: FIFO creation error for court %03d [errno: %d]\n", i, errno);
-			return -1;
-		}
-	}
+	// FIFOs are not created here: every player and court makes
+	// its own on launch, and open_fifo makes them if missing
 	
 	// Court semaphores
 	int sem = sem_get("court.c", (sc.rows * sc.cols));
@@ -79,19 +59,6 @@ int main_init(tournament_t* tm, struct conf sc){
 	}
 	tm->tm_data->tm_courts_sem = sem;
 
-	// Court flood semaphores
-	sem = sem_get("tide.c", (sc.rows * sc.cols));
-	if (sem < 0) {
-		log_write(ERROR_L, "Main: Error creating semaphore [errno: %d]\n", errno);
-		return -1;
-	}
-	log_write(INFO_L, "Main: Got semaphore %d with name %s\n", sem, "court.c");
-	if (sem_init_all(sem, (sc.rows * sc.cols), 0) < 0) {
-		log_write(ERROR_L, "Main: Error initializing the semaphore [errno: %d]\n", errno);
-		return -1;
-	}
-	tm->tm_data->tm_courts_flood_sem = sem;
-
 	// Players semaphores
 	sem = sem_get("player.c", sc.players);
 	if (sem < 0) {
@@ -121,61 +88,6 @@ int main_init(tournament_t* tm, struct conf sc){
 		return -1;
 	}
 	tm->tm_data->tm_init_sem = sem;
-}
-
-/* Launches a new process which will assume a
- * player's role. Each player is given an id, from which
- * the fifo of the player can be obtained. After launching the new 
- * player process, this function must call the
- * player_main function to allow it to play 
- * against other in a court. */
-int launch_player(unsigned int player_id, tournament_t* tm) {
-	
-	log_write(INFO_L, "Main: Launching player %03d!\n", player_id);
-
-	// New process, new player!
-	pid_t pid = fork();
-
-	if (pid < 0) { // Error
-		log_write(CRITICAL_L, "Main: Fork failed!\n");
-		return -1;
-	} else if (pid == 0) { // Son aka player
-		player_main(player_id, tm);
-		assert(false);	// Should not return!
-	} 
-	return 0;
-}
-
-
-
-int launch_court(unsigned int court_id, tournament_t* tm) {
-	log_write(INFO_L, "Main: Launching court %03d!\n", court_id);
-
-	// New process, new court!
-	pid_t pid = fork();
-
-	if (pid < 0) { // Error
-		log_write(CRITICAL_L, "Main: Fork failed!\n");
-		return -1;
-	} else if (pid == 0) { // Son aka court
-		court_main(court_id, tm);
-		assert(false); // Should not return!
-	}
-	return 0;
-}
-
-int launch_tide(tournament_t* tm, struct conf sc) {
-	log_write(INFO_L, "Main: Launching tide process!\n");
-
-	pid_t pid = fork();
-
-	if (pid < 0) { // Error
-		log_write(CRITICAL_L, "Main: Fork failed!\n");
-		return -1;
-	} else if (pid == 0) { // Son aka tide
-		tide_main(tm, sc);
-		assert(false); // Should not return!
-	}
 	return 0;
 }
 
@@ -186,13 +98,18 @@ void print_tournament_status(tournament_t* tm) {
 	log_write(INFO_L, "Main: %d players remain active!\n", tm->tm_data->tm_active_players);
 	for (i = 0; i < tm->total_courts; i++) {
 		court_data_t cd = tm->tm_data->tm_courts[i];
-		log_write(INFO_L, "Main: Court %03d is in state %d, with %d players inside\n", i, cd.court_status, cd.court_num_players);
+		int num_players = TM_COURT_NUM_PLAYERS(tm, i);
+		log_write(INFO_L, "Main: Court %03d is in state %d, with %d players inside\n", i, TM_COURT_STATUS(tm, i), num_players);
 		int j;
-		for (j = 0; j < cd.court_num_players; j++) {
+		for (j = 0; j < num_players; j++) {
 			log_write(INFO_L, "\t\t\t---> Player %03d is inside\n", cd.court_players[j]);
 		}
 	}
 	lock_release(tm->tm_lock);
+	// Histograms are lock free, so they can be read live
+	// (and the score table has its own lock)
+	latency_table_print(tm->lt);
+	score_table_print_top(tm->st);
 }
 
 
@@ -205,12 +122,12 @@ void print_tournament_results(tournament_t* tm) {
 	int color;
 	
 	int matches_completed = 0;
-	int max_score = 0;
 	log_write(STAT_L, "Player information!\n");
 	for (i = 0; i < tm->total_players; i++) {
 		player_data_t pd = tm->tm_data->tm_players[i];
-		color = (pd.player_pid % 20) * 2 + 1;
-		log_write(STAT_L, "\t\x1b[1;38;5;%dm - Player %03d, %s (had pid %d)\n", color, i, pd.player_name, pd.player_pid);
+		int pid = tm->tm_data->tm_players_state[i].player_pid;
+		color = (pid % 20) * 2 + 1;
+		log_write(STAT_L, "\t\x1b[1;38;5;%dm - Player %03d, %s (had pid %d)\n", color, i, pd.player_name, pid);
 		log_write(STAT_L, "\t\t\x1b[1;38;5;%dm %d matches finished:\n", color, pd.player_num_matches);
 		// Statistics
 		matches_completed += pd.player_num_matches;
@@ -224,21 +141,27 @@ void print_tournament_results(tournament_t* tm) {
 	}
 
 	log_write(STAT_L, "Matches completed: %d\n", matches_completed/PLAYERS_PER_MATCH);
-	// Get max score
-	for(i = 0; i < tm->total_players; i++) {
-		int p_score = get_player_score(tm->tm_data->st, i);
-		if(p_score > max_score) max_score = p_score;
-	}
-
-	// Get all players with that score
-	for(i = 0; i < tm->total_players; i++) {
-		int p_score = get_player_score(tm->tm_data->st, i);
-		char* p_name = tm->tm_data->tm_players[i].player_name;
-		if(p_score == max_score)
-			log_write(STAT_L, "\x1b[5m CONGRATULATIONS PLAYER %03d, %s, FOR WINNING (score: %d)\n", i, p_name, p_score);
+	// Winners come straight from the leaderboard
+	score_entry_t leaders[SCORE_TABLE_TOP_K];
+	size_t winners = score_table_get_leaders(tm->st, leaders, SCORE_TABLE_TOP_K);
+	size_t k;
+	for(k = 0; (k < winners) && (k < SCORE_TABLE_TOP_K); k++) {
+		char* p_name = tm->tm_data->tm_players[leaders[k].player_id].player_name;
+		log_write(STAT_L, "\x1b[5m CONGRATULATIONS PLAYER %03zu, %s, FOR WINNING (score: %u)\n", leaders[k].player_id, p_name, leaders[k].score);
 	}
-	
+	if(winners > SCORE_TABLE_TOP_K)
+		log_write(STAT_L, "\x1b[5m ...and %zu more players tied for the win!\n", (size_t) (winners - SCORE_TABLE_TOP_K));
+
+	// Court utilization, to see how evenly rows were used
+	log_write(STAT_L, "Matches completed per court (%d taken from another row):\n", tm->tm_data->tm_row_steals);
+	for (i = 0; i < tm->total_courts; i++)
+		log_write(STAT_L, "\tCourt %03d (row %d): %d (%d suspended by the tide)\n", i, (int) (i % tm->rows),
+				tm->tm_data->tm_courts[i].court_completed_matches, tm->tm_data->tm_courts[i].court_suspended_matches);
+	log_write(STAT_L, "Suspended matches resumed: %d\n", tm->tm_data->tm_resumed_matches);
 	lock_release(tm->tm_lock);
+
+	// Histograms are lock free: no need to stall everybody
+	latency_table_print(tm->lt);
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -253,9 +176,17 @@ int main(int argc, char **argv){
 	// otherwise, you don't know where you are going."
 	pid_t main_pid = getpid();
 	
+	// Locks and FIFOs live in these directories
+	mkdir("locks", 0777);
+	mkdir("fifos", 0777);
+	
+	// Shared by every process, so it goes before any fork
+	lock_profiler_get_instance();
+	
 	struct conf sc = {};
-	if(!read_conf_file(&sc)){
-		printf("FATAL: Error parsing configuration file [errno: %d]\n", errno);
+	if(!conf_load(&sc, argc, argv)){
+		printf("FATAL: Error parsing configuration [errno: %d]\n", errno);
+		printf("Usage: %s [conf file] [key=value ...]\n", argv[0]);
 		return -1;		
 	}
 	
@@ -264,40 +195,50 @@ int main(int argc, char **argv){
 		printf("FATAL: Error creating tournament data [errno: %d]\n", errno);
 		return -1;
 	}
+	log_write(INFO_L, "Main: Court scans use the %s kernel\n", court_scan_kernel_name());
+	log_write(INFO_L, "Main: Players retry with the %s policy\n", retry_policy_get(tm->tuning->retry_policy)->name);
 
 	if(main_init(tm, sc) < 0) {
 		printf("FATAL: Something went really wrong!\n");
 		return -1;
 	}
 
+	// Every other process is forked from the zygote, which
+	// starts with the whole tournament already set up
+	zygote_t* zg = zygote_start(tm, sc);
+	if(!zg) {
+		printf("FATAL: Error starting the zygote [errno: %d]\n", errno);
+		return -1;
+	}
+
 	log_write(NONE_L, "Main: Let the tournament begin!\n");
 	int i, j;
+	int alive = 0;
+	int players_running = 0;
 
-	// Launch players processes
+	// Launch players processes (one spawn request each)
 	for(i = 0; i < sc.players; i++){
-		launch_player(i, tm);
+		if(zygote_spawn(zg, ZYG_PLAYER, i)) {
+			alive++;
+			players_running++;
+		} else {
+			lock_acquire(tm->tm_lock);
+			tournament_player_left(tm);
+			lock_release(tm->tm_lock);
+		}
 	}
+	log_write(INFO_L, "Main: Launched %d players!\n", sc.players);
 	
 	// Launch tide
-	launch_tide(tm, sc);
+	log_write(INFO_L, "Main: Launching tide process!\n");
+	if(zygote_spawn(zg, ZYG_TIDE, 0))
+		alive++;
 	
-	// Create table of partners
-	partners_table_t* pt = partners_table_create(sc.players);
-	if(!pt) {
-		log_write(CRITICAL_L, "Main: Error creating partners table [errno: %d]\n", errno);
-	}
-
-	// Create score table
-	score_table_t* st = score_table_create(sc.players);
-	if(!st) {
-		log_write(CRITICAL_L, "Main: Error creating score table [errno: %d]\n", errno);
-	}
-
-	tournament_set_tables(tm, pt, st);
-
 	// Launch court processes
 	for (i = 0; i < tm->total_courts; i++) {
-		launch_court(i, tm);
+		log_write(INFO_L, "Main: Launching court %03d!\n", i);
+		if(zygote_spawn(zg, ZYG_COURT, i))
+			alive++;
 	}
 
 	// No child proccess should end here
@@ -316,39 +257,110 @@ int main(int argc, char **argv){
 	sem_take(sem_start, 0, MIN_PLAYERS_TO_START);
 	sem_put(sem_start, 1, sc.capacity);
 
-	bool courts_waken = false;
-	bool cut_condition = false;
+	bool draining = false;
+
+	// Main sleeps until a worker exits or the drain starts. The
+	// drain is started by whoever leaves the tournament with few
+	// enough players (see tournament_player_left)
+	while (alive > 0) {
+		struct pollfd fds[2] = {
+			{zg->event_fd, POLLIN, 0},
+			{tm->tm_end_fd, POLLIN, 0}
+		};
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			log_write(ERROR_L, "Main: Error waiting for events [errno: %d]\n", errno);
+			break;
+		}
+
+		if (fds[1].revents & POLLIN) {
+			uint64_t drains;
+			if (read(tm->tm_end_fd, &drains, sizeof(drains)) < 0)
+				log_write(ERROR_L, "Main: Error reading drain notification [errno: %d]\n", errno);
+		}
 
-	for (i = 0; i < (sc.players + tm->total_courts + 1); i++) {
-		int status;
-		int pid = wait(&status);
-		int ret = WEXITSTATUS(status);
-		log_write(INFO_L, "Main: Proccess pid %d finished with exit status %d\n", pid, ret);
-		
+		if (fds[0].revents & (POLLIN | POLLHUP)) {
+			zygote_event_t ev;
+			if (!zygote_next_exit(zg, &ev))
+				break;
+			alive--;
+			if (ev.role == ZYG_PLAYER)
+				players_running--;
+			int ret = WEXITSTATUS(ev.status);
+			if (ev.pid == ZYGOTE_SPAWN_FAILED) {
+				// It never ran, so it never left the tournament itself
+				log_write(ERROR_L, "Main: Worker %d of role %d couldn't be forked\n", ev.id, ev.role);
+				if (ev.role == ZYG_PLAYER) {
+					lock_acquire(tm->tm_lock);
+					tournament_player_left(tm);
+					lock_release(tm->tm_lock);
+				}
+			} else {
+				log_write(INFO_L, "Main: Proccess pid %d finished with exit status %d\n", ev.pid, ret);
+			}
+
+			// Rolling tournament: a player who left on their own is
+			// replaced by a fresh one, who takes the same seat
+			if (sc.rolling && (tournament_phase(tm) == TM_RUNNING) && (ev.role == ZYG_PLAYER) && (ret == PLAYER_EXIT_LEFT)) {
+				lock_acquire(tm->tm_lock);
+				tm->tm_data->tm_active_players++;
+				lock_release(tm->tm_lock);
+				partners_table_clear_player(tm->pt, ev.id);
+				if (zygote_spawn(zg, ZYG_PLAYER, ev.id)) {
+					log_write(INFO_L, "Main: Player %03d left, a fresh player takes their seat\n", ev.id);
+					alive++;
+					players_running++;
+				} else {
+					lock_acquire(tm->tm_lock);
+					tournament_player_left(tm);
+					lock_release(tm->tm_lock);
+				}
+			}
+		}
+
+		// Players gone some other way still drain the tournament
 		lock_acquire(tm->tm_lock);
-		int players_alive = tm->tm_data->tm_active_players;
+		if (players_running == 0)
+			tournament_begin_drain(tm);
 		lock_release(tm->tm_lock);
 
-		// Different cut condition based on player amount
-		if(sc.players > 20)
-			cut_condition = (players_alive <= (sc.players * 0.2));
-		else
-			cut_condition = (players_alive < 4);
+		if ((!draining) && (tournament_phase(tm) != TM_RUNNING)) {
+			// Drain: matches on course are played till the end,
+			// lobbies are emptied and everyone outside the beach
+			// is let in, just to leave
+			draining = true;
+			log_write(INFO_L, "Main: Enough matches performed. Draining the tournament!\n");
+			sem_put(sem_start, 1, sc.players);
+			lock_acquire(tm->tm_lock);
+			for (i = 0; i < tm->total_courts; i++)
+				tournament_wake_court(tm, i);
+			lock_release(tm->tm_lock);
+		}
 
-		if(cut_condition && (!courts_waken)) {
-			courts_waken = true;
-			log_write(INFO_L, "Main: Enough matches performed. Terminating processes!\n");
-			kill(0, SIGTERM);
+		if (draining && (players_running == 0) && (tournament_phase(tm) == TM_DRAINING)) {
+			// Final barrier: every player left, so courts (even
+			// flooded ones) are woken up to leave as well, and
+			// main waits for each of them
+			log_write(INFO_L, "Main: Every player left. Closing courts!\n");
+			lock_acquire(tm->tm_lock);
+			tournament_end(tm);
+			for (i = 0; i < tm->total_courts; i++)
+				tournament_wake_court(tm, i);
+			lock_release(tm->tm_lock);
 		}
 	}
 
+	zygote_stop(zg);
 	log_write(STAT_L, "Main: Tournament ended correctly \\o/\n");
 	print_tournament_results(tm);
+	lock_profiler_print();
+	score_table_print(tm->st);
+	if(!score_table_write_csv(tm->st, SCORES_CSV_ROUTE))
+		log_write(ERROR_L, "Main: Error writing %s [errno: %d]\n", SCORES_CSV_ROUTE, errno);
 
-	partners_table_free_table(pt);
 	tournament_free(tm);
-	score_table_free_table(st);		
 
 	log_close();
+	lock_profiler_free();
 	return 0;
 }
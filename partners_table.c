@@ -1,81 +1,103 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <stdint.h>
+#include <string.h>
 #include "lock.h"
 
 #include "partners_table.h"
 
+#if PARTNERS_SIMD && defined(__SSE2__)
+#include <emmintrin.h>
+#define PARTNERS_USE_SSE2 1
+#else
+#define PARTNERS_USE_SSE2 0
+#endif
+
+/* Auxiliar function that returns the amount of words
+ * a row takes for the received amount of players.*/
+size_t partners_row_words(size_t players){
+	size_t words = (players + PARTNERS_WORD_BITS - 1) / PARTNERS_WORD_BITS;
+	return (words + PARTNERS_ROW_ALIGN_WORDS - 1) & ~((size_t) PARTNERS_ROW_ALIGN_WORDS - 1);
+}
+
+/* Auxiliar function that returns the row of the received
+ * player (already zero based).*/
+static inline uint64_t* partners_row(partners_table_t* pt, size_t p_id){
+	return pt->rows + p_id * pt->row_words;
+}
+
+/* Auxiliar function that tells whether the two received
+ * rows have any bit set in common.*/
+static bool partners_rows_intersect(const uint64_t* a, const uint64_t* b, size_t words){
+	size_t i;
+#if PARTNERS_USE_SSE2
+	__m128i acc = _mm_setzero_si128();
+	for(i = 0; i < words; i += PARTNERS_ROW_ALIGN_WORDS) {
+		__m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+		acc = _mm_or_si128(acc, _mm_and_si128(va, vb));
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF;
+#else
+	uint64_t acc = 0;
+	for(i = 0; i < words; i++)
+		acc |= a[i] & b[i];
+	return acc != 0;
+#endif
+}
+
+/* Returns the amount of shared memory a partners_table
+ * for the received amount of players needs.*/
+size_t partners_table_shm_size(size_t players){
+	return sizeof(uint64_t) * partners_row_words(players) * players;
+}
+
+/* Dinamically allocates a new partners_table based on the
+ * amount of players received, placing its data at shm (which
+ * must be shared memory of partners_table_shm_size bytes).
+ * Returns NULL on error.*/
+partners_table_t* partners_table_create(size_t players, void* shm){
+	partners_table_t* pt = partners_table_attach(players, shm);
+	if(!pt) return NULL;
+
+	// Initialize table
+	memset(pt->rows, 0, partners_table_shm_size(players));
+
+	return pt;
+}
+
+/* Dinamically allocates a new handle for the partners_table
+ * already created at shm, leaving its data untouched.
+ * Returns NULL on error.*/
+partners_table_t* partners_table_attach(size_t players, void* shm){
+	if(!shm) return NULL;
 
-/* Dinamically allocates a new partners_table based on the 
- * amount of players received. Returns NULL on error.*/
-partners_table_t* partners_table_create(size_t players){
-	key_t key = ftok("makefile", 6);
-	if(key < 0) return NULL;
-	
 	partners_table_t* pt = malloc(sizeof(partners_table_t));
 	if(!pt) return NULL;
-	
+
 	pt->players_amount = players;
-	
+	pt->row_words = partners_row_words(players);
+
 	pt->lock = lock_create("partners_table");
 	if(!pt->lock){
 		free(pt);
 		return NULL;
 	}
-	
-	// Create table as shared memory
-	pt->shmid = shmget(key, sizeof(bool) * players * players, IPC_CREAT | 0644);
-	if(pt->shmid < 0){
-		lock_destroy(pt->lock);
-		free(pt);
-		return NULL;
-		}
-	
-	void* shm = shmat(pt->shmid, NULL, 0);
-	if(shm == (void*) -1) {
-		lock_destroy(pt->lock);
-		free(pt);
-		return NULL;
-		}
-	
-	pt->table = (bool*) shm;
-	
-	// Initialize table
-	int i, j;
-	for(i = 0; i < players; i++)
-		for(j = 0; j < players; j++)
-			pt->table[i * players + j] = false;
-	
+
+	pt->rows = (uint64_t*) shm;
+
 	return pt;
 }
 
-/* Destroys the allocated partners_table and detaches share
- * memory. This function SHOULD NOT be called in main
- * process (instead use function below).*/
+/* Destroys the allocated partners_table. Its shared memory
+ * belongs to whoever provided it, so it is left as is.*/
 void partners_table_destroy(partners_table_t* pt){
 	if(!pt) return;
 	lock_destroy(pt->lock);
-	// Detaches shared memory 
-	shmdt((void*) pt->table);
 	free(pt);
 }
 
-/* Destroys the partners table and also the shared memory
- * used inside it. This function is to replace the destroy
- * function for main process, and only main process should
- * call it.*/
-void partners_table_free_table(partners_table_t* pt){
-	if(!pt) return;
-
-	int idshm = pt->shmid;
-	partners_table_destroy(pt);
-	// Au revoir shared memory:
-	shmctl(idshm, IPC_RMID, NULL);
-}
-
 /* Checks if the two players received already played together.
  * Returns true if that was the case, or false otherwise. If
  * any of the players' id is greater than players_amount, it
@@ -90,9 +112,75 @@ bool get_played_together(partners_table_t* pt, size_t p1_id, size_t p2_id){
 		return false;
 
 	lock_acquire(pt->lock);
-	bool res = pt->table[p1_id * pt->players_amount + p2_id];
+	uint64_t word = partners_row(pt, p1_id)[p2_id / PARTNERS_WORD_BITS];
+	lock_release(pt->lock);
+	return (word >> (p2_id % PARTNERS_WORD_BITS)) & 1;
+}
+
+/* Checks every pair among the n candidates received (n up to
+ * PARTNERS_MAX_CANDIDATES) under a single lock. Returns a mask
+ * where PARTNERS_PAIR_BIT(i, j) is set if candidates i and j
+ * (i != j) never played together. Ids greater than
+ * players_amount are allowed to pair with anybody.*/
+uint64_t partners_table_allowed_pairs(partners_table_t* pt, const unsigned int* ids, size_t n){
+	if(n > PARTNERS_MAX_CANDIDATES) n = PARTNERS_MAX_CANDIDATES;
+	uint64_t allowed = 0;
+	size_t i, j;
+	for(i = 0; i < n; i++)
+		for(j = 0; j < n; j++)
+			if(i != j) allowed |= PARTNERS_PAIR_BIT(i, j);
+	if(!pt) return allowed;
+
+	// Row with a bit set on each candidate's column
+	size_t zb_ids[PARTNERS_MAX_CANDIDATES];
+	uint64_t candidates[pt->row_words];
+	memset(candidates, 0, sizeof(candidates));
+	for(i = 0; i < n; i++) {
+		zb_ids[i] = (START_AT_ZERO ? ids[i] : ids[i] - 1);
+		if(zb_ids[i] < pt->players_amount)
+			candidates[zb_ids[i] / PARTNERS_WORD_BITS] |= 1ULL << (zb_ids[i] % PARTNERS_WORD_BITS);
+	}
+
+	lock_acquire(pt->lock);
+	for(i = 0; i < n; i++) {
+		if(zb_ids[i] >= pt->players_amount) continue;
+		uint64_t* row = partners_row(pt, zb_ids[i]);
+		// Most rows share nothing with the candidates, so
+		// only those who do are checked one by one
+		if(!partners_rows_intersect(row, candidates, pt->row_words)) continue;
+		for(j = 0; j < n; j++) {
+			if((j == i) || (zb_ids[j] >= pt->players_amount)) continue;
+			if((row[zb_ids[j] / PARTNERS_WORD_BITS] >> (zb_ids[j] % PARTNERS_WORD_BITS)) & 1)
+				allowed &= ~(PARTNERS_PAIR_BIT(i, j) | PARTNERS_PAIR_BIT(j, i));
+		}
+	}
 	lock_release(pt->lock);
-	return res;
+	return allowed;
+}
+
+/* Stores at home and away the candidate indexes (0 to 3) each
+ * team gets on the received split.*/
+void partners_split_members(unsigned int split, unsigned int home[2], unsigned int away[2]){
+	home[0] = 0;
+	home[1] = split + 1;
+	unsigned int i, k = 0;
+	for(i = 1; i < 4; i++)
+		if(i != home[1])
+			away[k++] = i;
+}
+
+/* Returns a mask with bit k set if split k of the four players
+ * received is valid, i.e. none of both pairs played together.*/
+unsigned int partners_table_valid_splits(partners_table_t* pt, const unsigned int ids[4]){
+	uint64_t allowed = partners_table_allowed_pairs(pt, ids, 4);
+	unsigned int splits = 0, k;
+	for(k = 0; k < PARTNERS_SPLITS; k++) {
+		unsigned int home[2], away[2];
+		partners_split_members(k, home, away);
+		if((allowed & PARTNERS_PAIR_BIT(home[0], home[1])) && (allowed & PARTNERS_PAIR_BIT(away[0], away[1])))
+			splits |= 1U << k;
+	}
+	return splits;
 }
 
 /* Mark in the partners table the two players received (i.e.
@@ -109,7 +197,25 @@ void set_played_together(partners_table_t* pt, size_t p1_id, size_t p2_id){
 		return;
 
 	lock_acquire(pt->lock);
-	pt->table[p1_id * pt->players_amount + p2_id] = true;
-	pt->table[p2_id * pt->players_amount + p1_id] = true;
+	partners_row(pt, p1_id)[p2_id / PARTNERS_WORD_BITS] |= 1ULL << (p2_id % PARTNERS_WORD_BITS);
+	partners_row(pt, p2_id)[p1_id / PARTNERS_WORD_BITS] |= 1ULL << (p1_id % PARTNERS_WORD_BITS);
+	lock_release(pt->lock);
+}
+
+/* Forgets every partner of the received player, so that
+ * a new player can take their place. If the player's id is
+ * greater than players_amount, silently does nothing.*/
+void partners_table_clear_player(partners_table_t* pt, size_t p_id){
+	if(!pt) return;
+	if(!START_AT_ZERO)
+		p_id--;
+	if(p_id >= pt->players_amount)
+		return;
+
+	lock_acquire(pt->lock);
+	memset(partners_row(pt, p_id), 0, sizeof(uint64_t) * pt->row_words);
+	size_t i;
+	for(i = 0; i < pt->players_amount; i++)
+		partners_row(pt, i)[p_id / PARTNERS_WORD_BITS] &= ~(1ULL << (p_id % PARTNERS_WORD_BITS));
 	lock_release(pt->lock);
 }
@@ -4,32 +4,56 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "lock.h"
 
 // Set this flag if players ids start ar 0; clear it if ids start at 1
 #define START_AT_ZERO 1
 
+// Set this flag to check rows with SSE2; clear it for plain words
+#define PARTNERS_SIMD 1
+
+/* Every player has a row of bits, one per player, set if they
+ * already played together. Rows are padded to a whole amount of
+ * 128 bits, so a row goes through SSE2 registers with no tail.*/
+#define PARTNERS_WORD_BITS 64
+#define PARTNERS_ROW_ALIGN_WORDS 2
+
+/* Bulk queries take up to PARTNERS_MAX_CANDIDATES ids, and
+ * answer with one bit per ordered pair of them.*/
+#define PARTNERS_MAX_CANDIDATES 8
+#define PARTNERS_PAIR_BIT(i, j) (1ULL << ((i) * PARTNERS_MAX_CANDIDATES + (j)))
+
+/* A foursome can be split in two pairs in three ways. Split k
+ * teams candidate 0 up with candidate k + 1, and the other two
+ * candidates together.*/
+#define PARTNERS_SPLITS 3
+
 typedef struct partners_table_ {
 	size_t players_amount;
-	int shmid;
-	bool* table;
+	size_t row_words;
+	uint64_t* rows;
 	lock_t* lock;
 } partners_table_t;
 
-/* Dinamically allocates a new partners_table based on the 
- * amount of players received. Returns NULL on error.*/
-partners_table_t* partners_table_create(size_t players);
+/* Returns the amount of shared memory a partners_table
+ * for the received amount of players needs.*/
+size_t partners_table_shm_size(size_t players);
 
-/* Destroys the allocated partners_table and detaches share
- * memory. This function SHOULD NOT be called in main
- * process (instead use function below).*/
-void partners_table_destroy(partners_table_t* pt);
+/* Dinamically allocates a new partners_table based on the
+ * amount of players received, placing its data at shm (which
+ * must be shared memory of partners_table_shm_size bytes).
+ * Returns NULL on error.*/
+partners_table_t* partners_table_create(size_t players, void* shm);
 
-/* Destroys the partners table and also the shared memory
- * used inside it. This function is to replace the destroy
- * function for main process, and only main process should
- * call it.*/
-void partners_table_free_table(partners_table_t* pt);
+/* Dinamically allocates a new handle for the partners_table
+ * already created at shm, leaving its data untouched.
+ * Returns NULL on error.*/
+partners_table_t* partners_table_attach(size_t players, void* shm);
+
+/* Destroys the allocated partners_table. Its shared memory
+ * belongs to whoever provided it, so it is left as is.*/
+void partners_table_destroy(partners_table_t* pt);
 
 /* Checks if the two players received already played together.
  * Returns true if that was the case, or false otherwise. If
@@ -37,6 +61,26 @@ void partners_table_free_table(partners_table_t* pt);
  * just returns false.*/
 bool get_played_together(partners_table_t* pt, size_t p1_id, size_t p2_id);
 
+/* Checks every pair among the n candidates received (n up to
+ * PARTNERS_MAX_CANDIDATES) under a single lock. Returns a mask
+ * where PARTNERS_PAIR_BIT(i, j) is set if candidates i and j
+ * (i != j) never played together. Ids greater than
+ * players_amount are allowed to pair with anybody.*/
+uint64_t partners_table_allowed_pairs(partners_table_t* pt, const unsigned int* ids, size_t n);
+
+/* Returns a mask with bit k set if split k of the four players
+ * received is valid, i.e. none of both pairs played together.*/
+unsigned int partners_table_valid_splits(partners_table_t* pt, const unsigned int ids[4]);
+
+/* Stores at home and away the candidate indexes (0 to 3) each
+ * team gets on the received split.*/
+void partners_split_members(unsigned int split, unsigned int home[2], unsigned int away[2]);
+
+/* Forgets every partner of the received player, so that
+ * a new player can take their place. If the player's id is
+ * greater than players_amount, silently does nothing.*/
+void partners_table_clear_player(partners_table_t* pt, size_t p_id);
+
 /* Mark in the partners table the two players received (i.e.
  * they've already played together as partners). If any of
  * the players' id is greater than players_amount, silently
@@ -16,12 +16,9 @@
 #include "protocol.h"
 #include "semaphore.h"
 #include "tournament.h"
-
-// In microseconds!
-#define MIN_SCORE_TIME 900
-#define MAX_SCORE_TIME 3000
-
-#define MAX_ATTEMPTS 10
+#include "latency_table.h"
+#include "court_scan.h"
+#include "retry.h"
 
 /* Auxiliar function that generates a random skill field for a 
  * new player. It returns a number "s" for the skill such that 
@@ -38,21 +35,35 @@ size_t generate_random_skill(){
 	return (r_numb % interval_width) + SKILL_AVG - DELTA_SKILL;
 }
 
-/* Auxiliar function that makes the player sleep some time 
- * accordingly to their skill. A random component is added to the
- * time, so a little luck could be better than skill*/
-void emulate_score_time(){
-	player_t* player = player_get_instance();
-	unsigned long int x = SKILL_MAX - player_get_skill();
+/* Auxiliar function that returns the skill dependant part
+ * of the time a player takes to score a point.*/
+unsigned long int score_time_base(const tuning_t* tn, size_t skill){
+	unsigned long int x = SKILL_MAX - skill;
 	// Now x is in the range (0, SKILL_MAX) and it has low 
 	// values for good skilled players. Hence, we can map time 
 	// directly with x values (bigger x, bigger score time)
-	unsigned long int t = MIN_SCORE_TIME;
-	int pend = (MAX_SCORE_TIME - MIN_SCORE_TIME) / SKILL_MAX;
+	unsigned long int t = tn->score_min;
+	int pend = (tn->score_max - tn->score_min) / SKILL_MAX;
 	t += (unsigned long int) (pend * x);
+	return t;
+}
+
+/* Auxiliar function that returns the time the player takes to
+ * score their next point, accordingly to their skill. A random
+ * component is added to the time, so a little luck could be
+ * better than skill*/
+unsigned long int emulate_score_time(){
+	const tuning_t* tn = player_get_instance()->tm->tuning;
+	unsigned long int t = score_time_base(tn, player_get_skill());
 	// Random component of time. 
-	unsigned long int t_rand = rand() % MAX_SCORE_TIME;
-	usleep(t + t_rand);
+	unsigned long int t_rand = rand() % tn->score_max;
+	return t + t_rand;
+}
+
+/* Returns how long (in microseconds) a player with the
+ * received skill takes to score a point, on average.*/
+unsigned long int player_mean_score_time(const tuning_t* tn, size_t skill){
+	return score_time_base(tn, skill) + (tn->score_max - 1) / 2;
 }
 
 /* Dynamically creates a new player with a given name and properly 
@@ -64,7 +75,7 @@ player_t* player_create(){
 	player->skill = generate_random_skill();
 	player->matches_played = 0;
 	player->times_kicked = 0;
-	player->currently_playing = false;
+	player->retry_at = 0;
 	player->id = 0;
 	player->tm = NULL;
 	return player;
@@ -76,7 +87,8 @@ void player_seppuku(bool release_res){
 	if(release_res){
 		player_t* player =  player_get_instance();
 		lock_acquire(player->tm->tm_lock);
-		player->tm->tm_data->tm_active_players--;
+		tournament_drop_suspended(player->tm, player->id);
+		tournament_player_left(player->tm);
 		lock_release(player->tm->tm_lock);
 		
 		player_destroy(player);
@@ -130,134 +142,66 @@ char* player_get_name(){
 	return (player ? player->name : NULL);
 }
 
-/* Returns true or false if the player is or not playing.*/
-bool player_is_playing(){
-	player_t* player = player_get_instance();
-	return (player ? player->currently_playing : false);
-}
-
-/* Makes player stop playing.*/
-void player_stop_playing(){
-	player_t* player = player_get_instance();
-	if(player)
-		player->currently_playing = false;
-}
-
-/* Makes player start playing.*/
-void player_start_playing(){
-	player_t* player = player_get_instance();
-	if(player)
-		player->currently_playing = true;
-}
-
-/* Handler function for a player process. It should only be 
- * used with SIG_SET signal. Makes the player stop playing 
- * the set if they were playing.*/
-void handler_players_set(int signum) {
-	assert(signum == SIG_SET);
-	// Check if set is to start or finish
-	if(player_is_playing()) 
-		player_stop_playing();
-}
-
-/* Handler function for SIGTERM signal*/
-void player_handler_termination(int signum) {
-	assert(signum == SIGTERM);
-	player_t* player = player_get_instance();
-	log_write(INFO_L, "Player %03d: No more matches can be played. Player decided to leave the tournament on his own!\n", player->id);
-	player_seppuku(true);
-}
-
-void player_set_termination_handler() {
-	// Set the hanlder for the SIGTERM signal
-	struct sigaction sa;
-	sigset_t sigset;	
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = 0;
-	sa.sa_handler = player_handler_termination;
-	sigaction(SIGTERM, &sa, NULL);
-}
-
-void player_set_sigset_handler() {
-	// Set the hanlder for the SIG_SET signal
-	struct sigaction sa;
-	sigset_t sigset;	
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = 0;
-	sa.sa_handler = handler_players_set;
-	sigaction(SIG_SET, &sa, NULL);
-}
-
-void player_unset_sigset_handler() {
-	signal(SIG_SET, SIG_IGN);
-	return;
-}
-
 /* Make this player play the current set storing their score in 
- * the set_score variable. This function should do the following: 
- * make this player sleep an amount of time inversely proportional
- * to their skill, and after that, make it add a point to their 
- * score. Then, repeat all over while player_is_playing*/
-void player_play_set(unsigned long int* set_score){
-	player_t* player = player_get_instance();
-	if(!player) return;
-
-	while(player_is_playing()){
-		emulate_score_time();
+ * the set_score variable, until something else is broadcast on
+ * the court's channel (stored then at seen). This function should
+ * do the following: make this player wait an amount of time
+ * inversely proportional to their skill, and after that, make it
+ * add a point to their score. Then, repeat all over.*/
+void player_play_set(broadcast_t* bc, uint32_t* seen, unsigned long int* set_score){
+	while(!broadcast_wait(bc, seen, emulate_score_time()))
 		(*set_score)++;
-	}
 }
 
 
-/* Call this function once player has found a court to join.
- * Makes the player play every set and leave when necessary.*/
-void player_at_court(player_t* player, int court_fifo, int player_fifo) {
+/* Call this function once player has been accepted on a court.
+ * Makes the player play every set and leave when necessary,
+ * following what the court broadcasts on bc after seen (the
+ * word the court had when it accepted them).*/
+void player_at_court(player_t* player, int court_fifo, broadcast_t* bc, uint32_t seen) {
 	message_t msg = {};
-	char* p_name = player->name;
-	while(msg.m_type != MSG_MATCH_END){
-		int miss_count = 0;
-
-		if(!receive_msg(player_fifo, &msg)) {
-			log_write(ERROR_L, "Player %03d: Bad read [errno: %d]\n", player->id, errno);
-			close(court_fifo);
-			close(player_fifo);
-			player_seppuku(true);
-		}
-
-		if(msg.m_type == MSG_SET_START) {
-			unsigned long int set_score = 0;
+	unsigned long int set_score = 0;
+	bool pending = false;
+	while(true){
+		// The set just played may have ended with something
+		// else than MSG_SET_END, which is handled right away
+		if(!pending)
+			broadcast_wait(bc, &seen, 0);
+		pending = false;
+		msg_type event = BROADCAST_EVENT(seen);
+
+		if(event == MSG_SET_START) {
+			// Play the set until it's done
+			log_write(INFO_L, "Player %03d: Started playing\n", player->id);
+			set_score = 0;
+			player_play_set(bc, &seen, &set_score);
+			pending = true;
+		} else if(event == MSG_SET_END) {
+			// When set is finished, we use the fifo to send the
+			// court our set_score (0 if we didn't get to play it)
 			msg.m_type = MSG_PLAYER_SCORE;
 			msg.m_player_id = player->id;
-	
-			// Play the set until it's done (by SIG_SET)
-			log_write(INFO_L, "Player %03d: Started playing\n", player->id);
-			player_start_playing();
-			player_play_set(&set_score);
 			msg.m_score = set_score;
-			// When set is finished, we use the fifo to
-			// send main process our set_score
 			if(!send_msg(court_fifo, &msg))
 				log_write(ERROR_L, "Player %03d: Cannot write in court [errno: %d]\n", player->id, errno);
 			log_write(INFO_L, "Player %03d: Finished set (scored %lu)\n", player->id, set_score);
-		} else if(msg.m_type == MSG_MATCH_REJECT){
+			set_score = 0;
+		} else if(event == MSG_MATCH_REJECT){
 			// If here, player was accepted and was on the court a while
-			// but other players that arrived couldn't make a team with them.
-			// Hence, court kicked every player there
+			// but other players that arrived couldn't make a team with them,
+			// or the court got flooded. Hence, court kicked every player there
 			log_write(INFO_L, "Player %03d: Kicked from previously accepted court\n", player->id);
 			player->times_kicked++;
+			broadcast_ack(bc);
+			return;
+		} else if(event == MSG_MATCH_END) {
+			player->matches_played++;
+			broadcast_ack(bc);
 			return;
 		} else {
-			log_write(INFO_L, "Player %03d: Wont start playing, received message %d\n", player->id, msg.m_type);
-			miss_count++;
-			if (miss_count >= 2) {
-				log_write(INFO_L, "Player %03d: Kicked from previously accepted court\n", player->id);
-				player->times_kicked++;
-			}
+			log_write(INFO_L, "Player %03d: Wont start playing, court broadcast %d\n", player->id, event);
 		}
 	}
-	
-	if(msg.m_type == MSG_MATCH_END) // Not needed for now, but good sanity check
-		player->matches_played++;
 }
 
 /* Make the player join the court found. This function is the one that
@@ -265,8 +209,8 @@ void player_at_court(player_t* player, int court_fifo, int player_fifo) {
  * protocol of messages defined. It ends with either the player being
  * rejected by the court (aka player can play with no partner on the
  * court found), or with the player joining the court, calling the
- * function player_at_court.*/
-void player_join_court(player_t* player, unsigned int court_id) {
+ * function player_at_court. Returns true in the latter case.*/
+bool player_join_court(player_t* player, unsigned int court_id) {
 	log_write(INFO_L, "Player %03d: Found court %03d, attempting to join\n", player->id, court_id);
 	char court_fifo_name[MAX_FIFO_NAME_LEN];
 	get_court_fifo_name(court_id, court_fifo_name);
@@ -274,18 +218,19 @@ void player_join_court(player_t* player, unsigned int court_id) {
 	// Get the court key!!
 	sem_post(player->tm->tm_data->tm_courts_sem, court_id);
 
-	player_set_sigset_handler();
 	log_write(DEBUG_L, "Player %03d: Took semaphore of court %03d\n", player->id, court_id);
 
 	// Joining lobby!!
 	char* p_name;
 	p_name = player->name;
 	// Open court fifo
-	int court_fifo = open(court_fifo_name, O_WRONLY);
+	uint64_t t_start = latency_now();
+	int court_fifo = open_fifo(court_fifo_name, O_WRONLY);
 	if (court_fifo < 0) {
 		log_write(ERROR_L, "Player %03d: FIFO opening error for court %03d [errno: %d]\n", player->id, court_id, errno);
 		player_seppuku(true);
 	}
+	latency_record(player->tm->lt, LAT_FIFO_OPEN, t_start);
 	log_write(DEBUG_L, "Player %03d: Opened court %03d FIFO\n", player->id, court_id);
 
 	// Send "I want to play" message
@@ -304,18 +249,22 @@ void player_join_court(player_t* player, unsigned int court_id) {
 		log_write(ERROR_L, "Player %03d: FIFO player opening error [errno: %d]\n", player->id, errno);
 		player_seppuku(true);
 	}
-	int my_fifo = open(my_fifo_name, O_RDONLY);
+	t_start = latency_now();
+	int my_fifo = open_fifo(my_fifo_name, O_RDONLY);
 	if (my_fifo < 0) {
 		log_write(ERROR_L, "Player %03d: FIFO opening error for player [errno: %d]\n", player->id, errno);
 		player_seppuku(true);
 	}
+	latency_record(player->tm->lt, LAT_FIFO_OPEN, t_start);
 	log_write(DEBUG_L, "Player %03d: Opened self FIFO\n", player->id);
 
 	// If accepted join court
+	t_start = latency_now();
 	if(!receive_msg(my_fifo, &msg)) {
 		log_write(ERROR_L, "Player %03d: Error reading accepted/rejected msg [errno: %d]\n", player->id, errno);
 		player_seppuku(true);
 	}
+	latency_record(player->tm->lt, LAT_JOIN_REPLY, t_start);
 	
 	// Received a msg!!
 	bool qiq = ((msg.m_type == MSG_MATCH_ACCEPT) || (msg.m_type == MSG_MATCH_REJECT));
@@ -324,13 +273,13 @@ void player_join_court(player_t* player, unsigned int court_id) {
 		player_seppuku(true);
 	}
 
-	if (msg.m_type == MSG_MATCH_ACCEPT) {
-		player_at_court(player, court_fifo, my_fifo);
+	bool accepted = (msg.m_type == MSG_MATCH_ACCEPT);
+	if (accepted) {
+		player_at_court(player, court_fifo, &player->tm->tm_data->tm_courts[court_id].court_broadcast, msg.m_broadcast);
 	} else {
 		log_write(INFO_L, "Player %03d: Player was rejected from Court %03d\n", player->id, court_id);
 		player->times_kicked++;
 	}
-	player_unset_sigset_handler();
 
 	if (close(court_fifo) < 0)
 		log_write(ERROR_L, "Player %03d: Close court_fifo error [errno: %d]\n", player->id, errno);
@@ -338,57 +287,152 @@ void player_join_court(player_t* player, unsigned int court_id) {
 		log_write(ERROR_L, "Player %03d: Close self_fifo error [errno: %d]\n", player->id, errno);
 
 	log_write(DEBUG_L, "Player %03d: Released semaphore of court %03d\n", player->id, court_id);
-
+	return accepted;
 }
 
 
+/* Auxiliar function that returns the court row a player
+ * looks at first, spreading players evenly over rows.*/
+size_t player_home_row(unsigned int id, size_t rows){
+	uint32_t h = (uint32_t) id * 2654435761U; // Knuth's multiplicative hash
+	return (size_t) ((h >> 16) % rows);
+}
+
 /* The player who calls this function is willing to join a court.
- * Returns true if could found a court. */
-bool player_looking_for_court(player_t* player) {
+ * Returns how it went: the player played, was rejected, or found
+ * no court. In the last case, if park is set, the player is left
+ * on the waiting room for player_wait_for_court.*/
+retry_outcome player_looking_for_court(player_t* player, bool park) {
 	log_write(INFO_L, "Player %03d: Looking for a court\n", player->id);
 
 	// Search for a free court
 	int court_id = -1;
+	uint64_t t_start = latency_now();
 	lock_acquire(player->tm->tm_lock);
 	
-	int i;
+	// Search for a court with most num_players which has room.
+	//		   if there is a tie, choose the first one.
+	// Rows are visited starting on the player's own one, so ties
+	// stay at home: new lobbies spread over every row, and other
+	// rows are only stolen from for a fuller lobby (filling those
+	// first is what keeps the last players from getting stuck on
+	// different half empty courts). That's why every row is
+	// scanned unless a lobby one player short turns up: rows only
+	// spread where lobbies start, not the search itself.
+	// The whole search holds tm_lock, not a lock per row: besides
+	// the court arrays it reads suspended matches, the waiting
+	// room and tm_active_players, which aren't split by row, and
+	// courts change their status under tm_lock too. Rows keep the
+	// time under it short (a SIMD scan per row), not contention
+	tournament_data_t* tm_data = player->tm->tm_data;
+	size_t rows = player->tm->rows, cols = player->tm->cols;
+	size_t home_row = player_home_row(player->id, rows);
 	int best_so_far = -1;
 	int best_num_players = -1;
-	for (i = 0; i < player->tm->total_courts; i++) {
-		court_data_t cd = player->tm->tm_data->tm_courts[i];
-		
-		// Search for a court with most num_players which has room.
-		//		   if there is a tie, choose the first one.
-		if ((cd.court_status == TM_C_FREE) && (cd.court_num_players > best_num_players)) {
-			log_write(INFO_L, "Player %03d: checking for court %03d, and is %d with %d players\n", player->id, i, cd.court_status, cd.court_num_players);
-			best_so_far = i;
-			best_num_players = cd.court_num_players;
-		}
+	size_t k, best_k = 0;
+	// A player with a suspended match only goes to the court
+	// claiming it; if there's none yet (or it has no room
+	// left), they wait for one
+	int suspended = tm_data->tm_players_state[player->id].player_suspended;
+	if (suspended >= 0) {
+		best_so_far = tm_data->tm_suspended[suspended].sm_court;
+		if ((best_so_far >= 0) && (TM_COURT_NUM_PLAYERS(player->tm, best_so_far) >= PLAYERS_PER_MATCH))
+			best_so_far = -1;
 	}
-	if ((best_so_far >= 0) && (player->tm->tm_data->tm_active_players >= PLAYERS_PER_MATCH)) {
-		court_data_t cd = player->tm->tm_data->tm_courts[best_so_far];
-		cd.court_players[cd.court_num_players] = player->id;
-		cd.court_num_players++;
-		if (cd.court_num_players == PLAYERS_PER_MATCH)
-			cd.court_status = TM_C_BUSY;
-		player->tm->tm_data->tm_courts[best_so_far] = cd;
+	for (k = 0; (suspended < 0) && (k < rows) && (best_num_players < PLAYERS_PER_MATCH - 1); k++) {
+		size_t row = (home_row + k) % rows;
+		int col = court_scan_best_free(tm_data->tm_court_status + row * cols, tm_data->tm_court_num_players + row * cols, cols);
+		if ((col < 0) || (tm_data->tm_court_num_players[row * cols + col] <= best_num_players))
+			continue;
+		best_so_far = (int) TM_SLOT_COURT(player->tm, row * cols + col);
+		best_num_players = tm_data->tm_court_num_players[row * cols + col];
+		best_k = k;
+	}
+	bool running = (tournament_phase(player->tm) == TM_RUNNING);
+	if (running && (best_so_far >= 0) && (tm_data->tm_active_players >= PLAYERS_PER_MATCH)) {
+		uint8_t num_players = TM_COURT_NUM_PLAYERS(player->tm, best_so_far);
+		if (suspended >= 0)
+			log_write(INFO_L, "Player %03d: going back to their suspended match on court %03d\n", player->id, best_so_far);
+		else
+			log_write(INFO_L, "Player %03d: picked court %03d, with %d players\n", player->id, best_so_far, num_players);
+		if (best_k > 0)
+			tm_data->tm_row_steals++;
+		tm_data->tm_courts[best_so_far].court_players[num_players] = player->id;
+		TM_COURT_NUM_PLAYERS(player->tm, best_so_far) = ++num_players;
+		if (num_players == PLAYERS_PER_MATCH)
+			TM_COURT_STATUS(player->tm, best_so_far) = TM_C_BUSY;
+		player->tm->tm_data->tm_players_state[player->id].player_status = TM_P_PLAYING;
+		// Found one without being woken: nobody should spend a
+		// wake up on them
+		tournament_wait_leave(player->tm, player->id);
 		court_id = best_so_far;
+	} else {
+		// No room: wait on the waiting room, and remember
+		// when the first match is due to end. Once draining
+		// nobody would wake them, so they don't wait at all
+		if (running && park)
+			tournament_wait_enqueue(player->tm, player->id);
+		player->retry_at = 0;
+		int i;
+		for (i = 0; i < player->tm->total_courts; i++) {
+			uint64_t end = tm_data->tm_courts[i].court_predicted_end;
+			if (end && ((!player->retry_at) || (end < player->retry_at)))
+				player->retry_at = end;
+		}
 	}
 	lock_release(player->tm->tm_lock);
+	latency_record(player->tm->lt, LAT_COURT_SEARCH, t_start);
 
 	if (court_id < 0)
-		return false;
-	player_join_court(player, court_id);
-	return true;
+		return RETRY_NO_COURT;
+	bool played = player_join_court(player, court_id);
+
+	// Only this player writes its own status, no lock needed
+	player->tm->tm_data->tm_players_state[player->id].player_status = TM_P_IDLE;
+	return played ? RETRY_PLAYED : RETRY_REJECTED;
 }
 
 
 
+/* Parks the player, left on the waiting room by a failed
+ * player_looking_for_court, until a court gets room for them.
+ * Gives up after timeout microseconds, or shortly after a court
+ * is predicted to be released, whatever comes first.*/
+void player_wait_for_court(player_t* player, unsigned long int timeout) {
+	const tuning_t* tn = player->tm->tuning;
+	uint64_t now = latency_now();
+	if (player->retry_at > now) {
+		uint64_t until = player->retry_at - now + tn->park_grace;
+		if (until < timeout)
+			timeout = (unsigned long int) until;
+	}
+	player->retry_at = 0;
+	// The drain empties the waiting room, so whoever got in
+	// before it started is woken up anyway
+	if (tournament_phase(player->tm) != TM_RUNNING)
+		return;
+
+	log_write(INFO_L, "Player %03d: No room on any court, waiting for one\n", player->id);
+	if (sem_timedwait(player->tm->tm_data->tm_players_sem, player->id, timeout) < 0) {
+		if ((errno != EAGAIN) && (errno != EINTR))
+			log_write(ERROR_L, "Player %03d: Failed to wait for a court [errno: %d]\n", player->id, errno);
+		// Gave up: out of the waiting room, so that wake ups
+		// go to whoever is still parked
+		lock_acquire(player->tm->tm_lock);
+		tournament_wait_leave(player->tm, player->id);
+		lock_release(player->tm->tm_lock);
+		return;
+	}
+	log_write(INFO_L, "Player %03d: A court has room, woken up\n", player->id);
+}
+
 /* Function that makes the process adopt a player's role. Basically, 
  * it creates a player, and make them play the tournament.*/
 void player_main(unsigned int id, tournament_t* tm) {
-	// Re-srand with a changed seed
-	srand(time(NULL) ^ (getpid() << 16));
+	// Re-srand with a changed seed, which only depends on
+	// the player if the tournament has a seed of its own
+	size_t seed = tm->tm_data->tm_seed;
+	srand(seed ? (unsigned int) (seed ^ (id << 16)) : (unsigned int) (time(NULL) ^ (getpid() << 16)));
 	char p_name[NAME_MAX_LENGTH];
 	generate_random_name(p_name);
 	
@@ -396,15 +440,23 @@ void player_main(unsigned int id, tournament_t* tm) {
 	if(!player)
 		player_seppuku(false);
 
-	player_set_termination_handler();
 	player->id = id;
 	player_set_name(p_name);
 	player->tm = tm;
 	
+	// Create own FIFO before anyone can look for it
+	char my_fifo_name[MAX_FIFO_NAME_LEN];
+	get_player_fifo_name(id, my_fifo_name);
+	if(!create_fifo(my_fifo_name)) {
+		log_write(ERROR_L, "Player %03d: FIFO creation error [errno: %d]\n", id, errno);
+		player_seppuku(false);
+	}
+	
 	// Registering player info
 	lock_acquire(player->tm->tm_lock);
-	player->tm->tm_data->tm_players[id].player_num_matches = 0;
-	player->tm->tm_data->tm_players[id].player_pid = getpid();
+	player->tm->tm_data->tm_players_state[id].player_pid = getpid();
+	player->tm->tm_data->tm_players_state[id].player_status = TM_P_OUTSIDE;
+	player->tm->tm_data->tm_players_state[id].player_skill = player_get_skill();
 	strcpy(player->tm->tm_data->tm_players[id].player_name, p_name);
 	lock_release(player->tm->tm_lock);
 
@@ -422,50 +474,60 @@ void player_main(unsigned int id, tournament_t* tm) {
 	sem_wait(sem_start, 1);
 	lock_acquire(tm->tm_lock);
 	tm->tm_data->tm_on_beach_players++;
+	tm->tm_data->tm_players_state[id].player_status = TM_P_IDLE;
 	lock_release(tm->tm_lock);
 	log_write(INFO_L, "Player %03d: Has entered the beach\n", player->id);
 
 	int i, r;
-	bool cut_condition = false;
+	bool left_on_own = false;
 	int attempts = 0;
-	while((player->matches_played < tm->num_matches) && (attempts < MAX_ATTEMPTS)) {
+	unsigned int misses = 0; // Failed searches in a row, rejections too
+	const tuning_t* tn = tm->tuning;
+	const retry_policy_t* retry = retry_policy_get(tn->retry_policy);
+	while((player->matches_played < tm->num_matches) && (attempts < tn->max_attempts)) {
 		
-		lock_acquire(tm->tm_lock);
-		int players_alive = tm->tm_data->tm_active_players;
-		lock_release(tm->tm_lock);
+		if (tournament_phase(tm) != TM_RUNNING) {
+			log_write(INFO_L, "Player %03d: No more matches can be played. Leaving the tournament!\n", player->id);
+			break;
+		}
 		
 		unsigned long int prob = rand() % 100;
-		if (prob < LEAVING_PROB) {
+		if (prob < tn->leave_prob) {
+			// Beach is left below, as in any other way out
 			log_write(INFO_L, "Player %03d: Decided to leave the tournament on his own!\n", player->id);
-			sem_post(sem_start, 1);
-			lock_acquire(tm->tm_lock);
-			tm->tm_data->tm_on_beach_players--;
-			lock_release(tm->tm_lock);
+			left_on_own = true;
 			break;
 		}
 
-		if (prob < RESTING_PROB) {
+		if (prob < tn->rest_prob) {
 			log_write(INFO_L, "Player %03d: Decided to leave the beach!\n", player->id);
 			sem_post(sem_start, 1);
 			lock_acquire(tm->tm_lock);
 			tm->tm_data->tm_on_beach_players--;
+			tm->tm_data->tm_players_state[id].player_status = TM_P_OUTSIDE;
 			lock_release(tm->tm_lock);
-			unsigned long int t_rest = rand() % MAX_TIME_RESTING + 1000;
-			usleep(t_rest);
+			unsigned long int t_rest = rand() % tn->rest_max + tuning_scale(tn, 1000);
+			tournament_wait_phase(tm, TM_RUNNING, t_rest);
 			log_write(INFO_L, "Player %03d: Is back, wanting to enter the beach\n", player->id);
 			sem_wait(sem_start, 1);
 			lock_acquire(tm->tm_lock);
 			tm->tm_data->tm_on_beach_players++;
+			tm->tm_data->tm_players_state[id].player_status = TM_P_IDLE;
 			lock_release(tm->tm_lock);
 			log_write(INFO_L, "Player %03d: Has re-entered the beach successfully\n", player->id);
 			continue;
 		}
 
 		log_write(INFO_L, "Player %03d: Decided to play!\n", player->id);
-		if (!player_looking_for_court(player))
+		retry_outcome outcome = player_looking_for_court(player, retry->park);
+		if (outcome == RETRY_NO_COURT)
 			attempts++;
 		else
 			attempts = 0;
+		if (outcome == RETRY_PLAYED)
+			misses = 0;
+		else
+			misses++;
 		
 		// Sad ending for player: leaves when nobody loves him 
 		if (player->times_kicked == MAX_TIMES_KICKED) {
@@ -473,21 +535,30 @@ void player_main(unsigned int id, tournament_t* tm) {
 			break;
 		}
 		
-		// Wait some time before doing anything
-		unsigned long int t_rand = rand() % 2000000;
-		usleep(t_rand);
+		unsigned long int delay = retry->delay(tn, outcome, misses);
+		if ((outcome == RETRY_NO_COURT) && retry->park) {
+			player_wait_for_court(player, delay);
+			continue;
+		}
+		
+		// Rest as the policy says (or less, if the
+		// tournament is about to end)
+		if (delay > 0)
+			tournament_wait_phase(tm, TM_RUNNING, delay);
 	}
 	
 	sem_post(sem_start, 1);
 	lock_acquire(player->tm->tm_lock);
-	player->tm->tm_data->tm_active_players--;
+	tournament_drop_suspended(player->tm, id);
+	tournament_player_left(player->tm);
 	tm->tm_data->tm_on_beach_players--;
+	tm->tm_data->tm_players_state[id].player_status = TM_P_LEAVED;
 	lock_release(player->tm->tm_lock);
 
 	log_write(INFO_L, "Player %03d: Now leaving\n", player->id);
 	player_destroy(player);
 	log_close();
-	exit(0);
+	exit(left_on_own ? PLAYER_EXIT_LEFT : 0);
 	return; 
 }
 
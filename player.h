@@ -16,10 +16,11 @@
 
 
 #define MAX_SECONDS_OUTSIDE	20	// Up to 20 seconds before entering for the first time
-#define MAX_TIME_RESTING	5000000	// 5 seconds
-#define LEAVING_PROB		2	// 2%	Leaving the tournament completelly
-#define RESTING_PROB		15	// 15%	Leaving the tournament for a time with distribution ~U(0, MAX_SECONDS_RESTING)
-					//	Should be greater than LEAVING_PROB
+// Times and chances of leaving or resting are set on tuning.h
+
+// Exit status of a player who left the tournament on their
+// own (leave_prob, on tuning.h). On rolling tournaments they get replaced.
+#define PLAYER_EXIT_LEFT	2
 
 /* Third checkpoint major update: From now on, as
  * there will only be one player_t for each player
@@ -37,7 +38,9 @@ typedef struct player_ {
 	size_t skill;
 	size_t matches_played;
 	size_t times_kicked;
-	bool currently_playing;
+	// When a court is predicted to be released, as a latency_now
+	// timestamp. Set by a failed court search, 0 if unknown.
+	uint64_t retry_at;
 
 	tournament_t* tm;
 } player_t;
@@ -55,28 +58,24 @@ void player_set_name(char* name);
 /* Returns the skill of the current player.*/
 size_t player_get_skill();
 
+/* Returns how long (in microseconds) a player with the
+ * received skill takes to score a point, on average.*/
+unsigned long int player_mean_score_time(const tuning_t* tn, size_t skill);
+
 /* Returns the name of the current player.*/
 char* player_get_name();
 
 /* Make this player play the current set
  * storing their score in the set_score
- * variable. This function should do the
- * following: make this player sleep an
+ * variable, until something else is
+ * broadcast on the court's channel (stored
+ * then at seen). This function should do
+ * the following: make this player wait an
  * amount of time inversely proportional
  * to their skill, and after that, make
  * it add a point to their score. Then,
  * repeat all over.*/
-void player_play_set(unsigned long int* set_score);
-
-/* Returns true or false if the player
- * is or not playing.*/
-bool player_is_playing();
-
-/* Makes player stop playing.*/
-void player_stop_playing();
-
-/* Makes player stop playing.*/
-void player_start_playing();
+void player_play_set(broadcast_t* bc, uint32_t* seen, unsigned long int* set_score);
 
 void player_main(unsigned int id, tournament_t* tm);
 
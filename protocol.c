@@ -4,8 +4,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
 #include "log.h"
+#include "futex.h"
+#include "latency_table.h"
 #include "protocol.h"
 
 /* Stores player's fifo filename from their id on dest_buffer.
@@ -32,24 +38,253 @@ bool get_referee_fifo_name(char* dest_buffer) {
 	return true;
 }
 
+/* Creates the fifo at fifo_name. A fifo that already exists
+ * counts as success. Returns false on any other error.*/
 bool create_fifo(char* fifo_name){
-	if(mknod(fifo_name, FIFO_CREAT_FLAGS, 0) < 0)
+	if((mknod(fifo_name, FIFO_CREAT_FLAGS, 0) < 0) && (errno != EEXIST))
 		return false;
 	return true;
 }
 
+/* Opens the fifo at fifo_name with the received flags, creating
+ * it first if nobody did yet. Returns the file descriptor, or
+ * a negative number on error. Notice open is blocking.*/
+int open_fifo(char* fifo_name, int flags){
+	int fd;
+	while(((fd = open(fifo_name, flags)) < 0) && (errno == EINTR));
+	if((fd < 0) && (errno == ENOENT)) {
+		if(!create_fifo(fifo_name))
+			return -1;
+		while(((fd = open(fifo_name, flags)) < 0) && (errno == EINTR));
+	}
+	return fd;
+}
+
+/* Auxiliar function that sleeps until fd has something to
+ * read, or until the deadline (in latency_now microseconds,
+ * 0 for no limit) passes. Returns 1 if fd is readable (or hung
+ * up), 0 on timeout and a negative number on error.*/
+static int protocol_poll(int fd, uint64_t deadline){
+	struct pollfd pfd = {fd, POLLIN, 0};
+	while(true) {
+		int ms = -1;
+		if(deadline) {
+			uint64_t now = latency_now();
+			if(now >= deadline)
+				return 0;
+			// Rounded up, so it never wakes up just before time
+			uint64_t left = (deadline - now + 999) / 1000;
+			ms = (left > INT_MAX) ? INT_MAX : (int) left;
+		}
+		int r = poll(&pfd, 1, ms);
+		if(r > 0)
+			return 1;
+		if((r < 0) && (errno != EINTR))
+			return -1;
+	}
+}
+
+/* Auxiliar function that reads from fd until len bytes are
+ * stored at buf, restarting on EINTR. Returns how many bytes
+ * were read: less than len only if the other end closed, or a
+ * negative number on error.*/
+static ssize_t protocol_read_full(int fd, void* buf, size_t len){
+	size_t done = 0;
+	while(done < len) {
+		ssize_t r = read(fd, (char*) buf + done, len - done);
+		if(r == 0)
+			break;
+		if(r < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += r;
+	}
+	return (ssize_t) done;
+}
+
+/* Auxiliar function that writes the len bytes at buf to fd,
+ * restarting on EINTR and after short writes. Returns false
+ * on error.*/
+static bool protocol_write_full(int fd, const void* buf, size_t len){
+	size_t done = 0;
+	while(done < len) {
+		ssize_t w = write(fd, (const char*) buf + done, len - done);
+		if(w < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		done += w;
+	}
+	return true;
+}
+
+/* Auxiliar function that packs msg into a wire frame.*/
+static void protocol_encode(const message_t* msg, wire_frame_t* frame){
+	frame->w_version = PROTOCOL_VERSION;
+	frame->w_type = (uint8_t) msg->m_type;
+	frame->w_player_id = (uint16_t) msg->m_player_id;
+	if(msg->m_type == MSG_PLAYER_SCORE)
+		frame->w_payload = (msg->m_score > UINT32_MAX) ? UINT32_MAX : (uint32_t) msg->m_score;
+	else if(msg->m_type == MSG_MATCH_ACCEPT)
+		frame->w_payload = msg->m_broadcast;
+	else
+		frame->w_payload = (uint32_t) msg->m_court_id;
+}
+
+/* Auxiliar function that unpacks a wire frame into msg.
+ * Returns false if the frame isn't a valid one.*/
+static bool protocol_decode(const wire_frame_t* frame, message_t* msg){
+	if((frame->w_version != PROTOCOL_VERSION) || (frame->w_type > MSG_SET_END)) {
+		log_write(ERROR_L, "Protocol: Refused frame of version %d and type %d\n", frame->w_version, frame->w_type);
+		errno = EPROTO;
+		return false;
+	}
+	message_t m = {};
+	m.m_type = (msg_type) frame->w_type;
+	m.m_player_id = frame->w_player_id;
+	if(m.m_type == MSG_PLAYER_SCORE)
+		m.m_score = frame->w_payload;
+	else if(m.m_type == MSG_MATCH_ACCEPT)
+		m.m_broadcast = frame->w_payload;
+	else
+		m.m_court_id = frame->w_payload;
+	*msg = m;
+	return true;
+}
+
 /* Receives a message from fifo_fd and stores it on msg.
  * On any error, returns false. Notice read is blocking.*/
 bool receive_msg(int fifo_fd, message_t* msg){
-	if (read(fifo_fd, msg, sizeof(message_t)) < sizeof(message_t))
-		return false;
-	return true;
+	return receive_msgs(fifo_fd, msg, 1) == 1;
+}
+
+/* Same as receive_msg, but waits at most usec microseconds
+ * (0 for no limit). Returns false, with errno set to
+ * ETIMEDOUT, if no message arrived by then.*/
+bool receive_msg_timeout(int fifo_fd, message_t* msg, unsigned long int usec){
+	return receive_msgs_timeout(fifo_fd, msg, 1, usec) == 1;
 }
 
 /* Sends the message msg through fifo_fd. Returns true if
  * successful, or false otherwise.*/
 bool send_msg(int fifo_fd, message_t* msg){
-	if (write(fifo_fd, msg, sizeof(message_t)) < sizeof(message_t))
+	return send_msgs(fifo_fd, msg, 1);
+}
+
+/* Receives from fifo_fd up to n messages (n up to
+ * PROTOCOL_MAX_BATCH), as many as were already sent, and stores
+ * them on msgs. Blocks until there's at least one. Returns how
+ * many were received, or a negative number on error.*/
+int receive_msgs(int fifo_fd, message_t* msgs, int n){
+	return receive_msgs_timeout(fifo_fd, msgs, n, 0);
+}
+
+/* Same as receive_msgs, but waits at most usec microseconds
+ * (0 for no limit) for the first message. Returns 0, with
+ * errno set to ETIMEDOUT, if none arrived by then.*/
+int receive_msgs_timeout(int fifo_fd, message_t* msgs, int n, unsigned long int usec){
+	if((n <= 0) || (n > PROTOCOL_MAX_BATCH)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(usec) {
+		int ready = protocol_poll(fifo_fd, latency_now() + usec);
+		if(ready <= 0) {
+			if(ready == 0)
+				errno = ETIMEDOUT;
+			return ready;
+		}
+	}
+
+	wire_frame_t frames[PROTOCOL_MAX_BATCH];
+	ssize_t r;
+	while(((r = read(fifo_fd, frames, n * PROTOCOL_FRAME_SIZE)) < 0) && (errno == EINTR));
+	if(r <= 0)
+		return -1;
+	// A read may stop halfway through a frame; its other half
+	// is already on its way, as writers only send whole frames
+	size_t partial = r % PROTOCOL_FRAME_SIZE;
+	if(partial) {
+		size_t rest = PROTOCOL_FRAME_SIZE - partial;
+		if(protocol_read_full(fifo_fd, (char*) frames + r, rest) != (ssize_t) rest) {
+			log_write(ERROR_L, "Protocol: Frame cut short by the other end\n");
+			errno = EPROTO;
+			return -1;
+		}
+		r += rest;
+	}
+
+	int i, got = (int) (r / PROTOCOL_FRAME_SIZE);
+	for(i = 0; i < got; i++)
+		if(!protocol_decode(&frames[i], &msgs[i]))
+			return -1;
+	return got;
+}
+
+/* Sends the n messages (n up to PROTOCOL_MAX_BATCH) at msgs
+ * through fifo_fd, with a single write (restarted if it's
+ * interrupted). Returns true if successful, or false otherwise.*/
+bool send_msgs(int fifo_fd, message_t* msgs, int n){
+	if((n <= 0) || (n > PROTOCOL_MAX_BATCH)) {
+		errno = EINVAL;
 		return false;
+	}
+	wire_frame_t frames[PROTOCOL_MAX_BATCH];
+	int i;
+	for(i = 0; i < n; i++)
+		protocol_encode(&msgs[i], &frames[i]);
+	return protocol_write_full(fifo_fd, frames, n * PROTOCOL_FRAME_SIZE);
+}
+
+/* Returns the word currently held by the broadcast channel.*/
+uint32_t broadcast_current(broadcast_t* bc){
+	return __atomic_load_n(&bc->bc_word, __ATOMIC_ACQUIRE);
+}
+
+/* Broadcasts event to everybody waiting on bc, once the
+ * listeners of the last broadcast acknowledged it. Then,
+ * listeners of them must acknowledge this one (0 if no
+ * acknowledgement is needed).*/
+void broadcast_send(broadcast_t* bc, msg_type event, uint32_t listeners){
+	uint32_t pending;
+	while((pending = __atomic_load_n(&bc->bc_pending, __ATOMIC_ACQUIRE)) > 0)
+		futex_wait(&bc->bc_pending, pending, 0);
+
+	// Only the court broadcasts on its channel, so there's
+	// no other writer to race with
+	__atomic_store_n(&bc->bc_pending, listeners, __ATOMIC_RELAXED);
+	uint32_t word = broadcast_current(bc);
+	word = (((word >> 8) + 1) << 8) | ((uint32_t) event & 0xFF);
+	__atomic_store_n(&bc->bc_word, word, __ATOMIC_RELEASE);
+	futex_wake(&bc->bc_word, INT_MAX);
+}
+
+/* Acknowledges the last broadcast on bc, as one of its
+ * listeners.*/
+void broadcast_ack(broadcast_t* bc){
+	if(__atomic_sub_fetch(&bc->bc_pending, 1, __ATOMIC_RELEASE) == 0)
+		futex_wake(&bc->bc_pending, 1);
+}
+
+/* Sleeps until something newer than the word at seen is
+ * broadcast on bc, or until usec microseconds pass (0 for no
+ * limit). On a broadcast, stores its word at seen and returns
+ * true; on timeout, returns false.*/
+bool broadcast_wait(broadcast_t* bc, uint32_t* seen, unsigned long int usec){
+	uint64_t deadline = latency_now() + usec;
+	uint32_t word;
+	while((word = broadcast_current(bc)) == *seen) {
+		if(!usec) {
+			futex_wait(&bc->bc_word, *seen, 0);
+			continue;
+		}
+		if(latency_now() >= deadline)
+			return false;
+		futex_wait_until(&bc->bc_word, *seen, deadline);
+	}
+	*seen = word;
 	return true;
 }
@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdint.h>
 #include "log.h"
 #include "protocol.h"
 
@@ -15,9 +16,6 @@
 
 #define MAX_TIMES_KICKED 10
 
-#define SIG_SET SIGUSR1
-#define SIG_TIDE SIGUSR2
-
 // Number of player id which will be invalid
 #define MAX_COURTS 200
 #define MAX_PLAYERS 200
@@ -52,7 +50,8 @@ typedef enum _msg_type {
 	MSG_MATCH_REJECT,
 	MSG_MATCH_END,
 	MSG_FREE_COURT,
-	MSG_TOURNAMENT_END
+	MSG_TOURNAMENT_END,
+	MSG_SET_END
 } msg_type;
 
 
@@ -61,25 +60,132 @@ struct message {
 	unsigned int m_player_id;
 	unsigned long int m_score;
 	unsigned int m_court_id;
+	// Court's broadcast word when the player was accepted
+	uint32_t m_broadcast;
 };
 
 typedef struct message message_t;
 
+/*
+ *			Wire format
+ *
+ * Messages travel as packed frames of PROTOCOL_FRAME_SIZE bytes,
+ * made of fixed width fields in host byte order (both ends live
+ * on the same machine):
+ *
+ *	version (1) | type (1) | player id (2) | payload (4)
+ *
+ * The payload is the score on MSG_PLAYER_SCORE frames, the
+ * broadcast word on MSG_MATCH_ACCEPT ones, and the court id on
+ * any other. Frames of another version are refused.
+ * Every batch fits within PIPE_BUF, so it's written at once and
+ * never interleaved with other writers' frames on the same FIFO.
+ * Reads and writes are restarted when a signal interrupts them,
+ * and a read that stops halfway through a frame waits for the
+ * rest of it, so neither end ever sees a torn frame.
+ */
+#define PROTOCOL_VERSION 1
+
+typedef struct __attribute__((packed)) wire_frame_ {
+	uint8_t w_version;
+	uint8_t w_type;
+	uint16_t w_player_id;
+	uint32_t w_payload;
+} wire_frame_t;
+
+#define PROTOCOL_FRAME_SIZE sizeof(wire_frame_t)
+_Static_assert(PROTOCOL_FRAME_SIZE == 8, "wire frames must be 8 bytes long");
+
+// Most messages send_msgs and receive_msgs move at once
+#define PROTOCOL_MAX_BATCH 16
+
+/*
+ *			Broadcast channels
+ *
+ * Every court has a broadcast channel on shared memory, to tell
+ * all of its players at once that a set starts or ends, that the
+ * match ended, or that they're kicked. It's a single word: the
+ * event (a msg_type) on its low byte, and a generation above it,
+ * bumped on every broadcast. Sending costs one store and one
+ * futex wake of every waiter.
+ *
+ * Waiters sleep while the word still holds the last one they
+ * saw, so no broadcast is missed; but a late waiter only sees the
+ * latest event. That's why the court doesn't broadcast past a
+ * MSG_SET_END until every player sent their score, nor past the
+ * end of a match (MSG_MATCH_END or MSG_MATCH_REJECT) until every
+ * player there acknowledged it: otherwise, a player of the old
+ * match could wake up to the first set of the next one.
+ */
+#define BROADCAST_EVENT(word) ((msg_type) ((word) & 0xFF))
+
+typedef struct broadcast_ {
+	uint32_t bc_word;
+	uint32_t bc_pending;	// Listeners yet to acknowledge bc_word
+} broadcast_t;
+
 /* Stores player's fifo filename from their id on dest_buffer.
  * Returns true if it was successful, or false otherwise.*/
 bool get_player_fifo_name(unsigned int id, char* dest_buffer);
 bool get_court_fifo_name(unsigned int id, char* dest_buffer);
 bool get_referee_fifo_name(char* dest_buffer);
 
+/* Creates the fifo at fifo_name. A fifo that already exists
+ * counts as success. Returns false on any other error.*/
 bool create_fifo(char* fifo_name);
 
+/* Opens the fifo at fifo_name with the received flags, creating
+ * it first if nobody did yet. Returns the file descriptor, or
+ * a negative number on error. Notice open is blocking.*/
+int open_fifo(char* fifo_name, int flags);
+
 /* Receives a message from fifo_fd and stores it on msg.
  * On any error, returns false. Notice read is blocking.*/
 bool receive_msg(int fifo_fd, message_t* msg);
 
+/* Same as receive_msg, but waits at most usec microseconds
+ * (0 for no limit). Returns false, with errno set to
+ * ETIMEDOUT, if no message arrived by then.*/
+bool receive_msg_timeout(int fifo_fd, message_t* msg, unsigned long int usec);
+
 /* Sends the message msg through fifo_fd. Returns true if
  * successful, or false otherwise.*/
 bool send_msg(int fifo_fd, message_t* msg);
 
+/* Receives from fifo_fd up to n messages (n up to
+ * PROTOCOL_MAX_BATCH), as many as were already sent, and stores
+ * them on msgs. Blocks until there's at least one. Returns how
+ * many were received, or a negative number on error.*/
+int receive_msgs(int fifo_fd, message_t* msgs, int n);
+
+/* Same as receive_msgs, but waits at most usec microseconds
+ * (0 for no limit) for the first message. Returns 0, with
+ * errno set to ETIMEDOUT, if none arrived by then.*/
+int receive_msgs_timeout(int fifo_fd, message_t* msgs, int n, unsigned long int usec);
+
+/* Sends the n messages (n up to PROTOCOL_MAX_BATCH) at msgs
+ * through fifo_fd, with a single write (restarted if it's
+ * interrupted). Returns true if successful, or false otherwise.*/
+bool send_msgs(int fifo_fd, message_t* msgs, int n);
+
+/* Returns the word currently held by the broadcast channel.*/
+uint32_t broadcast_current(broadcast_t* bc);
+
+/* Broadcasts event to everybody waiting on bc, once the
+ * listeners of the last broadcast acknowledged it. Then,
+ * listeners of them must acknowledge this one (0 if no
+ * acknowledgement is needed).*/
+void broadcast_send(broadcast_t* bc, msg_type event, uint32_t listeners);
+
+/* Acknowledges the last broadcast on bc, as one of its
+ * listeners.*/
+void broadcast_ack(broadcast_t* bc);
+
+/* Sleeps until something newer than the word at seen is
+ * broadcast on bc, or until usec microseconds pass (0 for no
+ * limit). On a broadcast, stores its word at seen and returns
+ * true; on timeout, returns false.*/
+bool broadcast_wait(broadcast_t* bc, uint32_t* seen, unsigned long int usec);
+
 
 #endif //PROTOCOL_H
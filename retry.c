@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "retry.h"
+
+/* Auxiliar function that returns a random time on [0, max).*/
+static uint64_t retry_random(uint64_t max){
+	return max ? (uint64_t) rand() % max : 0;
+}
+
+/* Random policy: the same random rest whatever the outcome.*/
+static uint64_t retry_random_delay(const tuning_t* tn, retry_outcome outcome, unsigned int misses){
+	(void) outcome;
+	(void) misses;
+	return retry_random(tn->retry_max);
+}
+
+/* Park policy: a random rest after a match, and a whole park
+ * timeout (unless woken up earlier) when there was no court.*/
+static uint64_t retry_park_delay(const tuning_t* tn, retry_outcome outcome, unsigned int misses){
+	(void) misses;
+	if(outcome == RETRY_NO_COURT)
+		return tn->park_timeout;
+	return retry_random(tn->retry_max);
+}
+
+/* Backoff policy: no wait after a match. Otherwise, the wait
+ * doubles on every miss in a row up to the park timeout, and
+ * half of it is random so that players missing together don't
+ * come back together.*/
+static uint64_t retry_backoff_delay(const tuning_t* tn, retry_outcome outcome, unsigned int misses){
+	if(outcome == RETRY_PLAYED)
+		return 0;
+	uint64_t delay = tn->backoff_min;
+	while((misses-- > 1) && (delay < tn->park_timeout))
+		delay *= 2;
+	if(delay > tn->park_timeout)
+		delay = tn->park_timeout;
+	return delay / 2 + retry_random(delay / 2 + 1);
+}
+
+static const retry_policy_t retry_policies[RETRY_POLICIES] = {
+	{"random", retry_random_delay, false},
+	{"park", retry_park_delay, true},
+	{"backoff", retry_backoff_delay, true},
+};
+
+/* Returns the retry policy with the received index, or the
+ * default one if there's no such policy.*/
+const retry_policy_t* retry_policy_get(unsigned int id){
+	if(id >= RETRY_POLICIES)
+		id = RETRY_DEFAULT;
+	return &retry_policies[id];
+}
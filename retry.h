@@ -0,0 +1,47 @@
+#ifndef RETRY_H
+#define RETRY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "tuning.h"
+
+/*
+ * A retry policy tells a player how long to wait before looking
+ * for a court again, given how the last search went. Policies
+ * are picked with the RETRY parameter, by their index:
+ *
+ *	0 - random: rests up to RETRY_MAX after any search, even
+ *	    one with no court.
+ *	1 - park: rests up to RETRY_MAX after a match, and parks up
+ *	    to PARK_TIMEOUT when there's no court.
+ *	2 - backoff: looks again right after a match, and backs off
+ *	    exponentially (from BACKOFF_MIN up to PARK_TIMEOUT, with
+ *	    jitter) after a rejection, parking when there's no court.
+ *
+ * Parking players wait on the waiting room, so a court with room
+ * wakes them up before their time is over.
+ */
+
+#define RETRY_POLICIES 3
+#define RETRY_DEFAULT 2
+
+/* How the last search for a court went.*/
+typedef enum retry_outcome_ {RETRY_PLAYED, RETRY_REJECTED, RETRY_NO_COURT} retry_outcome;
+
+typedef struct retry_policy_ {
+	const char* name;
+	// Microseconds to wait after the outcome received, being
+	// misses the amount of failed searches in a row
+	uint64_t (*delay)(const tuning_t* tn, retry_outcome outcome, unsigned int misses);
+	// Set to wait for a court with room on the waiting room
+	// instead of sleeping when there's no court
+	bool park;
+} retry_policy_t;
+
+/* Returns the retry policy with the received index, or the
+ * default one if there's no such policy.*/
+const retry_policy_t* retry_policy_get(unsigned int id);
+
+#endif
@@ -2,22 +2,43 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "lock.h"
 #include "log.h"
 #include "player.h"
 #include "score_table.h"
 
+/* Returns the amount of shared memory a score_table for
+ * the received amount of players needs.*/
+size_t score_table_shm_size(size_t players){
+	return sizeof(score_board_t) + sizeof(unsigned int) * players;
+}
+
 /* Dinamically allocates a new score_table based on the 
- * amount of players received. Returns NULL on error.*/
-score_table_t* score_table_create(size_t players){
-	key_t key_s = ftok("makefile", 8);
-	if(key_s < 0) return NULL;
-	int i;
-	key_t key_n = ftok("makefile", 11);
-	if(key_n < 0) return NULL;
+ * amount of players received, placing its data at shm (which
+ * must be shared memory of score_table_shm_size bytes).
+ * Returns NULL on error.*/
+score_table_t* score_table_create(size_t players, void* shm){
+	score_table_t* st = score_table_attach(players, shm);
+	if(!st) return NULL;
+	
+	// Initialize table
+	size_t i;
+	for(i = 0; i < players; i++)
+		st->table[i] = 0;
+	st->board->top_score = 0;
+	st->board->top_count = 0;
+	st->board->size = 0;
+	
+	return st;
+}
+
+/* Dinamically allocates a new handle for the score_table
+ * already created at shm, leaving its data untouched.
+ * Returns NULL on error.*/
+score_table_t* score_table_attach(size_t players, void* shm){
+	if(!shm) return NULL;
 	
 	score_table_t* st = malloc(sizeof(score_table_t));
 	if(!st) return NULL;
@@ -30,54 +51,21 @@ score_table_t* score_table_create(size_t players){
 		return NULL;
 	}
 	
-	// Create score table as shared memory
-	st->shmid = shmget(key_s, sizeof(unsigned int) * players, IPC_CREAT | 0644);
-	if(st->shmid < 0){
-		lock_destroy(st->lock);
-		free(st);
-		return NULL;
-		}
-	
-	void* shm = shmat(st->shmid, NULL, 0);
-	if(shm == (void*) -1) {
-		lock_destroy(st->lock);
-		free(st);
-		return NULL;
-		}
-	
-	st->table = (unsigned int*) shm;
-	
-	// Initialize table
-	for(i = 0; i < players; i++)
-		st->table[i] = 0;
+	// Leaderboard goes first, scores right after it
+	st->board = (score_board_t*) shm;
+	st->table = (unsigned int*) (st->board + 1);
 	
 	return st;
 }
 
-/* Destroys the allocated partners_table and detaches share
- * memory. This function SHOULD NOT be called in main
- * process (instead use function below).*/
+/* Destroys the allocated score_table. Its shared memory
+ * belongs to whoever provided it, so it is left as is.*/
 void score_table_destroy(score_table_t* st){
 	if(!st) return;
 	lock_destroy(st->lock);
-	// Detaches shared memory 
-	shmdt((void*) st->table);
 	free(st);
 }
 
-/* Destroys the partners table and also the shared memory
- * used inside it. This function is to replace the destroy
- * function for main process, and only main process should
- * call it.*/
-void score_table_free_table(score_table_t* st){
-	if(!st) return;
-
-	int idshm = st->shmid;
-	score_table_destroy(st);
-	// Au revoir shared memory:
-	shmctl(idshm, IPC_RMID, NULL);
-}
-
 /* Returns the received player's score. If the received player
  * isn't on the score table, returns -1.*/
 unsigned int get_player_score(score_table_t* st, size_t player_id){
@@ -93,10 +81,72 @@ unsigned int get_player_score(score_table_t* st, size_t player_id){
 	return res;
 }
 
+/* Auxiliar function that rebuilds the whole leaderboard
+ * from the scores. Only needed if a score went down.
+ * Pre: the process has the score table lock.*/
+void score_board_rebuild(score_table_t* st){
+	score_board_t* board = st->board;
+	board->top_score = 0;
+	board->top_count = 0;
+	board->size = 0;
+	size_t i, j;
+	for(i = 0; i < st->players_amount; i++){
+		unsigned int score = st->table[i];
+		if(score == 0) continue;
+		if(score > board->top_score) {
+			board->top_score = score;
+			board->top_count = 0;
+		}
+		if(score == board->top_score)
+			board->top_count++;
+		// Sorted insertion on the top, if it fits
+		if((board->size == SCORE_TABLE_TOP_K) && (board->top[SCORE_TABLE_TOP_K - 1].score >= score))
+			continue;
+		j = (board->size < SCORE_TABLE_TOP_K ? board->size++ : SCORE_TABLE_TOP_K - 1);
+		for(; (j > 0) && (board->top[j - 1].score < score); j--)
+			board->top[j] = board->top[j - 1];
+		board->top[j].player_id = i + (START_AT_ZERO ? 0 : 1);
+		board->top[j].score = score;
+	}
+}
+
+/* Auxiliar function that updates the leaderboard after the
+ * received player's score went up to score. It takes O(K).
+ * Pre: the process has the score table lock.*/
+void score_board_update(score_board_t* board, size_t player_id, unsigned int score){
+	if(score > board->top_score) {
+		board->top_score = score;
+		board->top_count = 1;
+	} else if(score == board->top_score) {
+		board->top_count++;
+	}
+
+	// Look for the player on the top. If missing, it gets in only
+	// by beating the last one (everyone outside is below it).
+	size_t pos;
+	for(pos = 0; pos < board->size; pos++)
+		if(board->top[pos].player_id == player_id)
+			break;
+	if(pos == board->size) {
+		if(board->size < SCORE_TABLE_TOP_K)
+			board->size++;
+		else if(board->top[SCORE_TABLE_TOP_K - 1].score < score)
+			pos = SCORE_TABLE_TOP_K - 1;
+		else
+			return;
+	}
+	// Bubble it up (ties stay behind who got there first)
+	for(; (pos > 0) && (board->top[pos - 1].score < score); pos--)
+		board->top[pos] = board->top[pos - 1];
+	board->top[pos].player_id = player_id;
+	board->top[pos].score = score;
+}
+
 /* Increase the received player's score by the amount provided.
  * If such player isn't on the score table, silently does nothing.*/
 void increase_player_score(score_table_t* st, size_t player_id, int amount){
 	if(!st) return;
+	size_t board_id = player_id;
 	if(!START_AT_ZERO)	player_id--;
 	
 	if(player_id >= st->players_amount)
@@ -104,27 +154,132 @@ void increase_player_score(score_table_t* st, size_t player_id, int amount){
 
 	lock_acquire(st->lock);
 	st->table[player_id] += amount;
+	if(amount > 0)
+		score_board_update(st->board, board_id, st->table[player_id]);
+	else if(amount < 0)
+		score_board_rebuild(st);
+	lock_release(st->lock);
+}
+
+/* Returns the highest score of the tournament so far,
+ * in O(1). Returns 0 if nobody has scored yet.*/
+unsigned int score_table_get_top_score(score_table_t* st){
+	if(!st) return 0;
+	lock_acquire(st->lock);
+	unsigned int res = st->board->top_score;
 	lock_release(st->lock);
+	return res;
+}
+
+/* Stores on leaders up to max of the players who share the
+ * highest score, and returns how many players share it (which
+ * may be more than the ones stored, if it exceeds max or
+ * SCORE_TABLE_TOP_K). Returns 0 if nobody has scored yet.*/
+size_t score_table_get_leaders(score_table_t* st, score_entry_t* leaders, size_t max){
+	if(!st) return 0;
+	lock_acquire(st->lock);
+	size_t res = st->board->top_count;
+	size_t i;
+	for(i = 0; (i < max) && (i < res) && (i < st->board->size); i++)
+		leaders[i] = st->board->top[i];
+	lock_release(st->lock);
+	return res;
+}
+
+/* Stores on dest the best (up to) k players, sorted by score,
+ * in O(k). Returns the amount of players stored, which is at
+ * most SCORE_TABLE_TOP_K.*/
+size_t score_table_snapshot_top(score_table_t* st, score_entry_t* dest, size_t k){
+	if(!st) return 0;
+	lock_acquire(st->lock);
+	size_t i;
+	for(i = 0; (i < k) && (i < st->board->size); i++)
+		dest[i] = st->board->top[i];
+	lock_release(st->lock);
+	return i;
+}
+
+/* Print the current leaderboard on log.*/
+void score_table_print_top(score_table_t* st){
+	if(!st) return;
+	score_entry_t top[SCORE_TABLE_TOP_K];
+	size_t n = score_table_snapshot_top(st, top, SCORE_TABLE_TOP_K);
+	log_write(STAT_L, "Leaderboard (top %d)\n", SCORE_TABLE_TOP_K);
+	size_t i;
+	for(i = 0; i < n; i++)
+		log_write(STAT_L, "\t#%02d Player %03d with score %u\n", (int) (i + 1), (int) top[i].player_id, top[i].score);
 }
 
-#define TABLE_LINE_LENGTH 50
+// Worst case length of a report line (10 digit id and score)
+#define TABLE_LINE_LENGTH 64
+#define CSV_HEADER "player_id,score\n"
+
+/* Formats a snapshot of the received score_table on a new
+ * buffer, using the format requested. The scores are copied
+ * at once under the lock, and formatting is linear on the
+ * amount of players. Stores the report length at len and
+ * returns the buffer (to be freed by the caller), or NULL
+ * on error.*/
+char* score_table_report(score_table_t* st, score_format fmt, size_t* len){
+	if(!st) return NULL;
+	size_t players = st->players_amount;
+	unsigned int* snapshot = malloc(sizeof(unsigned int) * players);
+	if(!snapshot) return NULL;
+	size_t size = TABLE_LINE_LENGTH * (players + 1) + 1;
+	char* report = malloc(sizeof(char) * size);
+	if(!report) {
+		free(snapshot);
+		return NULL;
+	}
+
+	lock_acquire(st->lock);
+	memcpy(snapshot, st->table, sizeof(unsigned int) * players);
+	lock_release(st->lock);
+
+	// Every line is written at the cursor, no rescans
+	size_t cursor = 0;
+	if(fmt == SCORE_FMT_CSV)
+		cursor += snprintf(report, size, CSV_HEADER);
+	size_t i;
+	for(i = 0; i < players; i++){
+		int id = i + (START_AT_ZERO ? 0 : 1);
+		if(fmt == SCORE_FMT_CSV)
+			cursor += snprintf(report + cursor, size - cursor, "%d,%u\n", id, snapshot[i]);
+		else
+			cursor += snprintf(report + cursor, size - cursor, "\n--- Player %03d has a total score of %u ---", id, snapshot[i]);
+	}
+	if(fmt == SCORE_FMT_LOG)
+		cursor += snprintf(report + cursor, size - cursor, "\n");
+
+	free(snapshot);
+	*len = cursor;
+	return report;
+}
 
 /* Print the received score_table on log.*/
 void score_table_print(score_table_t* st){
-	int i = 0, j;
-	if(!START_AT_ZERO) i++;
-	char* mega_string = malloc(sizeof(char) * TABLE_LINE_LENGTH * st->players_amount + 1);
-	if(!mega_string) return;
-	
-	sprintf(mega_string, "\n--- Player %03d has a total score of %d ---", i, get_player_score(st, i));
-	for(j = 1; j < st->players_amount; j++){
-		i++;
-		char aux_buff[TABLE_LINE_LENGTH];
-		sprintf(aux_buff, "\n--- Player %03d has a total score of %d ---", i, get_player_score(st, i));
-		strcat(mega_string, aux_buff);
+	size_t len;
+	char* report = score_table_report(st, SCORE_FMT_LOG, &len);
+	if(!report) return;
+	log_write(NONE_L, "%s", report);
+	free(report);
+}
+
+/* Writes the received score_table as CSV on the file at
+ * route, with a single write. Returns true if successful,
+ * or false otherwise.*/
+bool score_table_write_csv(score_table_t* st, char* route){
+	size_t len;
+	char* report = score_table_report(st, SCORE_FMT_CSV, &len);
+	if(!report) return false;
+	int fd = open(route, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if(fd < 0) {
+		free(report);
+		return false;
 	}
-	
-	strcat(mega_string, "\n");
-	log_write(NONE_L, mega_string);
-	free(mega_string);
+	ssize_t written = write(fd, report, len);
+	bool res = (written >= 0) && (written == (ssize_t) len);
+	close(fd);
+	free(report);
+	return res;
 }
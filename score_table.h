@@ -9,27 +9,60 @@
 // Set this flag if players ids start ar 0; clear it if ids start at 1
 #define START_AT_ZERO 1
 
+// Route of the CSV report written at the end of the tournament
+#define SCORES_CSV_ROUTE "scores.csv"
+
+// Amount of players kept sorted on the leaderboard
+#define SCORE_TABLE_TOP_K 10
+
+/* Output formats for score_table_report.*/
+typedef enum score_format_ {
+	SCORE_FMT_LOG,
+	SCORE_FMT_CSV
+} score_format;
+
+typedef struct score_entry_ {
+	size_t player_id;
+	unsigned int score;
+} score_entry_t;
+
+/* Leaderboard stored next to the scores. It keeps the best
+ * SCORE_TABLE_TOP_K players sorted by score (ties in order of
+ * arrival), and how many players share the top score. It is
+ * updated on every increase_player_score, relying on scores
+ * never going down.*/
+typedef struct score_board_ {
+	unsigned int top_score;
+	size_t top_count;
+	size_t size;
+	score_entry_t top[SCORE_TABLE_TOP_K];
+} score_board_t;
+
 typedef struct score_table_ {
 	size_t players_amount;
-	int shmid;
 	unsigned int* table;
+	score_board_t* board;
 	lock_t* lock;
 } score_table_t;
 
+/* Returns the amount of shared memory a score_table for
+ * the received amount of players needs.*/
+size_t score_table_shm_size(size_t players);
+
 /* Dinamically allocates a new score_table based on the 
- * amount of players received. Returns NULL on error.*/
-score_table_t* score_table_create(size_t players);
+ * amount of players received, placing its data at shm (which
+ * must be shared memory of score_table_shm_size bytes).
+ * Returns NULL on error.*/
+score_table_t* score_table_create(size_t players, void* shm);
 
-/* Destroys the allocated partners_table and detaches share
- * memory. This function SHOULD NOT be called in main
- * process (instead use function below).*/
-void score_table_destroy(score_table_t* st);
+/* Dinamically allocates a new handle for the score_table
+ * already created at shm, leaving its data untouched.
+ * Returns NULL on error.*/
+score_table_t* score_table_attach(size_t players, void* shm);
 
-/* Destroys the partners table and also the shared memory
- * used inside it. This function is to replace the destroy
- * function for main process, and only main process should
- * call it.*/
-void score_table_free_table(score_table_t* st);
+/* Destroys the allocated score_table. Its shared memory
+ * belongs to whoever provided it, so it is left as is.*/
+void score_table_destroy(score_table_t* st);
 
 /* Returns the received player's score. If the received player
  * isn't on the score table, returns -1.*/
@@ -39,7 +72,38 @@ unsigned int get_player_score(score_table_t* st, size_t player_id);
  * If such player isn't on the score table, silently does nothing.*/
 void increase_player_score(score_table_t* st, size_t player_id, int amount);
 
+/* Returns the highest score of the tournament so far,
+ * in O(1). Returns 0 if nobody has scored yet.*/
+unsigned int score_table_get_top_score(score_table_t* st);
+
+/* Stores on leaders up to max of the players who share the
+ * highest score, and returns how many players share it (which
+ * may be more than the ones stored, if it exceeds max or
+ * SCORE_TABLE_TOP_K). Returns 0 if nobody has scored yet.*/
+size_t score_table_get_leaders(score_table_t* st, score_entry_t* leaders, size_t max);
+
+/* Stores on dest the best (up to) k players, sorted by score,
+ * in O(k). Returns the amount of players stored, which is at
+ * most SCORE_TABLE_TOP_K.*/
+size_t score_table_snapshot_top(score_table_t* st, score_entry_t* dest, size_t k);
+
+/* Print the current leaderboard on log.*/
+void score_table_print_top(score_table_t* st);
+
+/* Formats a snapshot of the received score_table on a new
+ * buffer, using the format requested. The scores are copied
+ * at once under the lock, and formatting is linear on the
+ * amount of players. Stores the report length at len and
+ * returns the buffer (to be freed by the caller), or NULL
+ * on error.*/
+char* score_table_report(score_table_t* st, score_format fmt, size_t* len);
+
 /* Print the received score_table on log.*/
 void score_table_print(score_table_t* st);
 
+/* Writes the received score_table as CSV on the file at
+ * route, with a single write. Returns true if successful,
+ * or false otherwise.*/
+bool score_table_write_csv(score_table_t* st, char* route);
+
 #endif
@@ -1,8 +1,10 @@
+#define _GNU_SOURCE
 #include "semaphore.h"
 
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/sem.h>
+#include <time.h>
 #include "log.h"
 #include <assert.h>
 
@@ -93,6 +95,27 @@ int sem_wait(int semid, unsigned int semnum) {
 	return sem_take(semid, semnum, 1);
 }
 
+/*
+ * Same as sem_wait, but gives up after usec microseconds.
+ * Returns 0 if the semaphore was taken, negative otherwise
+ * (errno is EAGAIN if the time ran out).
+ */
+int sem_timedwait(int semid, unsigned int semnum, unsigned long int usec) {
+	struct sembuf sop = {semnum, -1, SEM_OP_FLAG};
+	struct timespec ts = {usec / 1000000, (usec % 1000000) * 1000};
+	return semtimedop(semid, &sop, 1, &ts);
+}
+
+/*
+ * Same as sem_wait, but never blocks. Returns 0 if the
+ * semaphore was taken, negative otherwise (errno is EAGAIN
+ * if it was 0).
+ */
+int sem_trywait(int semid, unsigned int semnum) {
+	struct sembuf sop = {semnum, -1, SEM_OP_FLAG | IPC_NOWAIT};
+	return semop(semid, &sop, 1);
+}
+
 /*
  * Increment by one the semnum-th semaphore of set semid, and
  * wakens any other process that were blocked on a sem_wait()
@@ -15,6 +15,8 @@ int sem_init_all(int semid, int semnum, int value);
 int sem_put(int semid, unsigned int semnum, unsigned int value);
 int sem_take(int semid, unsigned int semnum, unsigned int value);
 int sem_wait(int semid, unsigned int semnum);
+int sem_timedwait(int semid, unsigned int semnum, unsigned long int usec);
+int sem_trywait(int semid, unsigned int semnum);
 int sem_post(int semid, unsigned int semnum);
 int sem_waitz(int semid, unsigned int semnum);
 
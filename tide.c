@@ -2,100 +2,185 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
 #include "tide.h"
 #include "tournament.h"
 #include "lock.h"
 #include "confparser.h"
 #include "log.h"
 
-void print_tournament_status(tournament_t* tm);
+/* Auxiliar function that appends an event to the tide
+ * schedule. Returns false on error.*/
+bool tide_add_event(tide_t* tide, size_t* capacity, char cmd, uint64_t at){
+	if(tide->num_events == *capacity) {
+		size_t new_capacity = (*capacity ? *capacity * 2 : 64);
+		tide_event_t* events = realloc(tide->events, new_capacity * sizeof(tide_event_t));
+		if(!events) return false;
+		tide->events = events;
+		*capacity = new_capacity;
+	}
+	tide->events[tide->num_events].te_cmd = cmd;
+	tide->events[tide->num_events].te_at = at;
+	tide->num_events++;
+	return true;
+}
+
+/* Auxiliar function that loads the whole tide file into the
+ * schedule. Each line waits on the previous one, so delays are
+ * added up into times since the tide started. Returns false
+ * on error.*/
+bool tide_load_schedule(tide_t* tide, FILE* pf){
+	size_t capacity = 0;
+	uint64_t at = 0;
+	int r = 8;
+	// For every line in pf, parse its value
+	while(r > 0){
+		char param[15];
+		unsigned long int t_value = 0;
+		r = fscanf(pf, "%14s : %lu\n", param, &t_value);
+		if(r != 2) continue;
+		if((strcmp(param, "F") != 0) && (strcmp(param, "E") != 0)) continue;
+		at += t_value;
+		if(!tide_add_event(tide, &capacity, param[0], at))
+			return false;
+	}
+	return true;
+}
+
+/* Auxiliar function that loads the schedule of TIDE_FILE.
+ * Returns false on error.*/
+bool tide_load_file(tide_t* tide){
+	FILE* pf = fopen(TIDE_FILE, "r");
+	if(!pf) return false;
+	bool loaded = tide_load_schedule(tide, pf);
+	fclose(pf);
+	return loaded;
+}
+
+/* Auxiliar function that sets the generator up as the received
+ * configuration says. A seed of 0 is replaced by one taken from
+ * the clock. Returns false on error.*/
+bool tide_start_generator(tide_t* tide, struct conf sc){
+	tide->random = true;
+	tide->seed = (sc.seed ? (unsigned int) sc.seed : (unsigned int) (time(NULL) ^ getpid()));
+	tide->flow_mean = sc.tide_flow_mean * 1000.0;
+	tide->ebb_mean = sc.tide_ebb_mean * 1000.0;
+	tide->max_level = (sc.tide_max_level > sc.rows ? sc.rows : sc.tide_max_level);
+	tide->level = -1;
+	tide->at = 0;
+
+	tide->replay = fopen(TIDE_REPLAY_FILE, "w");
+	if(!tide->replay) return false;
+	fprintf(tide->replay, "/* Random tides, generated with seed %u.\nUse this file as %s to replay them. */\n", tide->seed, TIDE_FILE);
+	fflush(tide->replay);
+	return true;
+}
+
+/* Auxiliar function that draws a time from an exponential
+ * distribution with the received mean, using the tide seed.*/
+double tide_draw_exp(tide_t* tide, double mean){
+	double u = (rand_r(&tide->seed) + 1.0) / (RAND_MAX + 1.0);
+	return -mean * log(u);
+}
+
+/* Auxiliar function that generates the next random tide event,
+ * and writes it on the replay file. Returns false if there's
+ * none (no flows nor ebbs are possible).*/
+bool tide_generate_event(tide_t* tide, tide_event_t* ev){
+	// Whatever can happen on this level races the other
+	double flow_rate = ((tide->level < tide->max_level - 1) && (tide->flow_mean > 0)) ? 1.0 / tide->flow_mean : 0;
+	double ebb_rate = ((tide->level >= 0) && (tide->ebb_mean > 0)) ? 1.0 / tide->ebb_mean : 0;
+	double total_rate = flow_rate + ebb_rate;
+	if(total_rate <= 0) return false;
+
+	uint64_t wait = (uint64_t) tide_draw_exp(tide, 1.0 / total_rate);
+	double pick = rand_r(&tide->seed) / (RAND_MAX + 1.0);
+	ev->te_cmd = (pick * total_rate < flow_rate) ? 'F' : 'E';
+	tide->level += (ev->te_cmd == 'F') ? 1 : -1;
+	tide->at += wait;
+	ev->te_at = tide->at;
+
+	if(tide->replay) {
+		fprintf(tide->replay, "%c : %llu\n", ev->te_cmd, (unsigned long long) wait);
+		fflush(tide->replay);
+	}
+	return true;
+}
+
+/* Auxiliar function that stores at ev the next event the tide
+ * has to run. Returns false if there are no more.*/
+bool tide_next_event(tide_t* tide, tide_event_t* ev){
+	if(tide->random)
+		return tide_generate_event(tide, ev);
+	if(tide->next_event == tide->num_events)
+		return false;
+	*ev = tide->events[tide->next_event++];
+	return true;
+}
 
-/* Dynamically creates new tide.*/
+/* Dynamically creates new tide, with no events yet.*/
 tide_t* tide_create(){	
 	tide_t* tide = malloc(sizeof(tide_t));
 	if(!tide)	return NULL;
-	
-	tide->pf = fopen(TIDE_FILE, "r");
-	
-	if(!tide->pf) {
-		free(tide);
-		return NULL;
-		} 
-	
+	tide->events = NULL;
+	tide->num_events = 0;
+	tide->next_event = 0;
+	tide->random = false;
+	tide->replay = NULL;
 	return tide;
 }
 
-/* Handles the flowing of the tide*/
-void tide_flow(tournament_t* tm, struct conf sc){
-
-	// Disable (if possible) sc.rows courts and signal them
+/* Handles the flowing of the tide: the next row of courts
+ * gets flooded, and each of its courts is woken up right away.*/
+void tide_flow(tournament_t* tm){
+	int flooded = 0, interrupted = 0;
 	lock_acquire(tm->tm_lock);
 	int actual_tide = tm->tm_data->tm_tide_lvl;
-	log_write(INFO_L, "Tide: Flowing! (tide level: %d -> %d)\n", actual_tide, ((actual_tide+1) > (sc.rows) ? sc.rows : actual_tide));
-
 	tm->tm_data->tm_tide_lvl++;
-	if (tm->tm_data->tm_tide_lvl > sc.rows)
-		tm->tm_data->tm_tide_lvl = sc.rows;
-
-	int i;
-	for (i = 0; i < tm->total_courts; i++) {
-		int prev_state = tm->tm_data->tm_courts[i].court_status;
-		if ((i % sc.rows) == tm->tm_data->tm_tide_lvl) {
-			tm->tm_data->tm_courts[i].court_status = TM_C_FLOODED;
-			kill(tm->tm_data->tm_courts[i].court_pid, SIG_TIDE);
+	if (tm->tm_data->tm_tide_lvl > (int) tm->rows)
+		tm->tm_data->tm_tide_lvl = (int) tm->rows;
+	int new_tide = tm->tm_data->tm_tide_lvl;
+
+	// Row tide level is a run of cols slots (see TM_COURT_SLOT)
+	if (new_tide < (int) tm->rows) {
+		size_t slot;
+		for (slot = new_tide * tm->cols; slot < (new_tide + 1) * tm->cols; slot++) {
+			if (tm->tm_data->tm_court_status[slot] == TM_C_BUSY)
+				interrupted++;
+			tournament_court_flooded(tm, TM_SLOT_COURT(tm, slot));
+			flooded++;
 		}
-		log_write(STAT_L, "Court %03d is in state %d (previously %d)\n", i, tm->tm_data->tm_courts[i].court_status, prev_state);
 	}
-	print_tournament_status(tm);
 	lock_release(tm->tm_lock);
-	// with SIG_TIDE signal to make them kick players
+	log_write(INFO_L, "Tide: Flowing! (tide level: %d -> %d), %d courts flooded, %d of them busy\n", actual_tide, new_tide, flooded, interrupted);
 }
 
-/* Handles the ebbing of the tide*/
-void tide_ebb(tournament_t* tm, struct conf sc){
-	// Enable (if possible) sc.rows courts
+/* Handles the ebbing of the tide: water goes down on the
+ * highest flooded row, and its courts are woken up (each marks
+ * itself as free once done with the flood).*/
+void tide_ebb(tournament_t* tm){
+	int dried = 0;
 	lock_acquire(tm->tm_lock);
 	int actual_tide = tm->tm_data->tm_tide_lvl;
-	log_write(INFO_L, "Tide: Ebbing! (tide level: %d -> %d)\n", actual_tide, ((actual_tide-1) < 0 ? -1 : actual_tide));
-
-	int i;
-	for (i = 0; i < tm->total_courts; i++) {
-		int prev_state = tm->tm_data->tm_courts[i].court_status;
-		if ((i % sc.rows) == tm->tm_data->tm_tide_lvl) {
-			tm->tm_data->tm_courts[i].court_status = TM_C_FREE;
-			kill(tm->tm_data->tm_courts[i].court_pid, SIG_TIDE);
+	if ((actual_tide >= 0) && (actual_tide < (int) tm->rows)) {
+		size_t slot;
+		for (slot = actual_tide * tm->cols; slot < (actual_tide + 1) * tm->cols; slot++) {
+			if (tm->tm_data->tm_court_status[slot] != TM_C_FLOODED)
+				continue;
+			tournament_court_dried(tm, TM_SLOT_COURT(tm, slot));
+			dried++;
 		}
-		log_write(STAT_L, "Court %03d is in state %d\n", i, tm->tm_data->tm_courts[i].court_status, prev_state);
 	}
-	print_tournament_status(tm);
 
 	tm->tm_data->tm_tide_lvl--;
 	if (tm->tm_data->tm_tide_lvl < 0)
 		tm->tm_data->tm_tide_lvl = -1;
-
+	int new_tide = tm->tm_data->tm_tide_lvl;
 	lock_release(tm->tm_lock);
-}
-
-/* Parses current read line from tide file. If the line
- * specifies tide to flow or ebb (via F or E letters),
- * this function sleeps t_value microseconds and then
- * executes the proper function.*/
-void tide_parse_command(struct conf sc, char* param, unsigned long int t_value, tournament_t* tm){
-	if(!param) return;
-	
-	if(strcmp(param, "F") == 0) {
-		usleep(t_value);
-		tide_flow(tm, sc);
-		return;
-		}
-		
-	if(strcmp(param, "E") == 0) {
-		usleep(t_value);
-		tide_ebb(tm, sc);
-		return;
-		}
-		
+	log_write(INFO_L, "Tide: Ebbing! (tide level: %d -> %d), %d courts dried\n", actual_tide, new_tide, dried);
 }
 
 // ------------------------------------------------------------
@@ -114,10 +199,12 @@ tide_t* tide_get_instance(){
 /* Destroys the current tide.*/
 void tide_destroy(){
 	tide_t* tide = tide_get_instance();
-	if(tide && tide->pf)
-		fclose(tide->pf);
-	if(tide)
+	if(tide) {
+		if(tide->replay)
+			fclose(tide->replay);
+		free(tide->events);
 		free(tide);
+	}
 }
 
 
@@ -129,15 +216,36 @@ void tide_main(tournament_t* tm, struct conf sc){
 		exit(-1);
 	}
 	
-	int r = 8;
-	// For every line in pf, parse its value
-	while(r > 0){
-		char param[15];
-		unsigned long int t_value = 0;
-		r = fscanf(tide->pf, "%s : %lu\n", param, &t_value);
-		if(r == 2) {
-			tide_parse_command(sc, param, t_value, tm);
+	if(sc.random_tides) {
+		if(!tide_start_generator(tide, sc)) {
+			log_write(ERROR_L, "Tide: Couldn't open %s [errno: %d]\n", TIDE_REPLAY_FILE, errno);
+			exit(-1);
+		}
+		log_write(INFO_L, "Tide: Random tides with seed %u\n", tide->seed);
+	} else {
+		if(!tide_load_file(tide)) {
+			log_write(ERROR_L, "Tide: Couldn't load %s [errno: %d]\n", TIDE_FILE, errno);
+			exit(-1);
+		}
+		log_write(INFO_L, "Tide: Loaded %zu tide events\n", tide->num_events);
+	}
+	
+	// Every event is due at a fixed time since now, so the time
+	// spent flowing or ebbing doesn't delay the following ones.
+	// Like every other sleep, it's compressed by the time scale
+	uint64_t origin = latency_now();
+	tide_event_t event;
+	while(tide_next_event(tide, &event)){
+		tide_event_t* ev = &event;
+		if(!tournament_wait_phase_until(tm, TM_RUNNING, origin + tuning_scale(tm->tuning, ev->te_at))) {
+			// Matches on course are let finish in peace
+			log_write(INFO_L, "Tide: Tournament is ending, no more tides\n");
+			break;
 			}
+		if(ev->te_cmd == 'F')
+			tide_flow(tm);
+		else
+			tide_ebb(tm);
 		}
 
 	tide_destroy();
@@ -5,15 +5,44 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "tournament.h"
 #include "confparser.h"
 
 #define TIDE_FILE "tide.txt"
-
-
+// Random tides are written here, as a tide file, so that a run
+// can be replayed by using it as TIDE_FILE
+#define TIDE_REPLAY_FILE "tide_replay.txt"
+
+
+/* Tide schedule entry: a command (F for flow, E for ebb) and
+ * when to run it, in microseconds since the tide started.*/
+typedef struct tide_event_ {
+	char te_cmd;
+	uint64_t te_at;
+} tide_event_t;
+
+/* The tide runs events in turn, waiting for each absolute time.
+ * They come either from TIDE_FILE, loaded once as a whole, or
+ * from a generator: flows and ebbs arrive as two Poisson
+ * processes, each one with its own mean time between events,
+ * with the level kept between no rows and max_level rows
+ * flooded. The generator has its own seed, so the same seed
+ * always gives the same tides.*/
 typedef struct tide_ {
-	FILE *pf;
+	tide_event_t* events;
+	size_t num_events;
+	size_t next_event;
+
+	bool random;
+	unsigned int seed;
+	double flow_mean;
+	double ebb_mean;
+	int max_level;
+	int level;
+	uint64_t at;
+	FILE* replay;
 } tide_t;
 
 /* Returns the current tide singleton!*/
@@ -4,7 +4,13 @@
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/eventfd.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
 #include "lock.h"
+#include "log.h"
+#include "futex.h"
 #include "tournament.h"
 #include "confparser.h"
 
@@ -12,10 +18,12 @@
 #include "protocol.h"
 #include "player.h"
 
-tournament_t* tournament_create(struct conf sc) {
-	key_t key = ftok("makefile", 77);
-	if (key < 0) return NULL;
-	
+#define TOURNAMENT_ARENA_KEY 77
+
+/* Auxiliar function that builds the per process handle of the
+ * tournament stored on the arena received. If init is set, the
+ * shared tables are also initialized. Returns NULL on error.*/
+tournament_t* tournament_build(arena_t* arena, bool init) {
 	tournament_t* tm = malloc(sizeof(tournament_t));
 	if (!tm) return NULL;
 	
@@ -24,24 +32,103 @@ tournament_t* tournament_create(struct conf sc) {
 		free(tm);
 		return NULL;
 	}
+	tm->tm_arena = arena;
+	tm->tm_data = (tournament_data_t*) arena_ptr(arena, arena_get_root(arena));
+	tm->tm_end_fd = -1;
 	
-	tm->tm_shmid = shmget(key, sizeof(tournament_data_t), IPC_CREAT | 0644);
-	if (tm->tm_shmid < 0) {
-		lock_destroy(tm->tm_lock);
-		free(tm);
+	size_t players = tm->tm_data->tm_total_players;
+	void* st_shm = arena_ptr(arena, tm->tm_data->tm_st_off);
+	void* pt_shm = arena_ptr(arena, tm->tm_data->tm_pt_off);
+	void* lt_shm = arena_ptr(arena, tm->tm_data->tm_lt_off);
+	if (init) {
+		tm->st = score_table_create(players, st_shm);
+		tm->pt = partners_table_create(players, pt_shm);
+		tm->lt = latency_table_create(lt_shm);
+	} else {
+		tm->st = score_table_attach(players, st_shm);
+		tm->pt = partners_table_attach(players, pt_shm);
+		tm->lt = latency_table_attach(lt_shm);
+	}
+	// Filled by tournament_create before anyone attaches
+	tm->tuning = tuning_attach(arena_ptr(arena, tm->tm_data->tm_tuning_off));
+	
+	tm->total_players = players;
+	tm->total_courts = tm->tm_data->tm_total_courts;
+	tm->rows = tm->tm_data->tm_rows;
+	tm->cols = tm->tm_data->tm_cols;
+	tm->num_matches = tm->tm_data->tm_num_matches;
+	if (!(tm->st && tm->pt && tm->lt && tm->tuning)) {
+		tm->tm_arena = NULL; // Arena belongs to the caller
+		tournament_destroy(tm);
 		return NULL;
 	}
+	return tm;
+}
+
+/* Creates the tournament arena, with the tournament data and
+ * every shared table on it. Returns NULL on error.*/
+tournament_t* tournament_create(struct conf sc) {
+	key_t key = ftok("makefile", TOURNAMENT_ARENA_KEY);
+	if (key < 0) return NULL;
 	
-	void *shm = shmat(tm->tm_shmid, NULL, 0);
-	if (shm == (void*) -1) {
-		lock_destroy(tm->tm_lock);
-		free(tm);
+	size_t capacity = arena_footprint(sizeof(tournament_data_t))
+		+ arena_footprint(score_table_shm_size(sc.players))
+		+ arena_footprint(partners_table_shm_size(sc.players))
+		+ arena_footprint(latency_table_shm_size())
+		+ arena_footprint(tuning_shm_size());
+	arena_t* arena = arena_create(key, capacity);
+	if (!arena) return NULL;
+	
+	arena_off_t root = arena_alloc(arena, sizeof(tournament_data_t));
+	tournament_data_t* tm_data = (tournament_data_t*) arena_ptr(arena, root);
+	tm_data->tm_st_off = arena_alloc(arena, score_table_shm_size(sc.players));
+	tm_data->tm_pt_off = arena_alloc(arena, partners_table_shm_size(sc.players));
+	tm_data->tm_lt_off = arena_alloc(arena, latency_table_shm_size());
+	tm_data->tm_tuning_off = arena_alloc(arena, tuning_shm_size());
+	if (!tuning_create(arena_ptr(arena, tm_data->tm_tuning_off), sc)) {
+		arena_free(arena);
 		return NULL;
 	}
+	tm_data->tm_total_players = sc.players;
+	tm_data->tm_total_courts = (sc.rows * sc.cols);
+	tm_data->tm_rows = sc.rows;
+	tm_data->tm_cols = sc.cols;
+	tm_data->tm_num_matches = sc.matches;
+	tm_data->tm_seed = sc.seed;
+	arena_set_root(arena, root);
 	
-	tm->tm_data = (tournament_data_t*) shm;
-
+	tournament_t* tm = tournament_build(arena, true);
+	if (!tm) {
+		arena_free(arena);
+		return NULL;
+	}
+	// Initialized first, so that tournament_free sees no
+	// semaphores yet (and doesn't destroy set 0)
 	tournament_init(tm, sc);
+	// Created before any fork, so every worker can notify main
+	tm->tm_end_fd = eventfd(0, 0);
+	if (tm->tm_end_fd < 0) {
+		tournament_free(tm);
+		return NULL;
+	}
+	return tm;
+}
+
+/* Attaches to the tournament created by another process, even
+ * if it's not related to it. Returns NULL on error.*/
+tournament_t* tournament_attach() {
+	key_t key = ftok("makefile", TOURNAMENT_ARENA_KEY);
+	if (key < 0) return NULL;
+	
+	arena_t* arena = arena_attach(key);
+	if (!arena) return NULL;
+	if (arena_get_root(arena) == ARENA_NULL) {
+		arena_destroy(arena);
+		return NULL;
+	}
+	
+	tournament_t* tm = tournament_build(arena, false);
+	if (!tm) arena_destroy(arena);
 	return tm;
 }
 
@@ -49,44 +136,353 @@ tournament_t* tournament_create(struct conf sc) {
 void tournament_init(tournament_t* tm, struct conf sc) {
 	int i, j;
 	for (i = 0; i < sc.players; i++) {
-		tm->tm_data->tm_players[i].player_status = TM_P_IDLE;
+		tm->tm_data->tm_players_state[i].player_status = TM_P_IDLE;
+		tm->tm_data->tm_players_state[i].player_pid = -1;
+		tm->tm_data->tm_players_state[i].player_skill = SKILL_AVG;
+		tm->tm_data->tm_players_state[i].player_waiting = false;
+		tm->tm_data->tm_players_state[i].player_suspended = -1;
 		tm->tm_data->tm_players[i].player_num_matches = 0;
 	}
 
 	for (i = 0; i < MAX_COURTS; i++) {
 		court_data_t cd;
-		cd.court_num_players = 0;
 		cd.court_completed_matches = 0;
 		cd.court_suspended_matches = 0;
-		cd.court_status = TM_C_FREE;
 		cd.court_pid = -1;
+		cd.court_predicted_end = 0;
+		cd.court_wakeups = 0;
+		cd.court_resume = -1;
+		cd.court_flood = 0;
+		cd.court_broadcast.bc_word = 0;
+		cd.court_broadcast.bc_pending = 0;
 		for(j = 0; j < PLAYERS_PER_MATCH; j++)
 			cd.court_players[j] = INVALID_PLAYER_ID;
 		tm->tm_data->tm_courts[i] = cd;
+		tm->tm_data->tm_court_status[i] = TM_C_FREE;
+		tm->tm_data->tm_court_num_players[i] = 0;
 	}
 
 	tm->tm_data->tm_active_players = sc.players;
+	// Different cut condition based on player amount
+	if (sc.players > 20)
+		tm->tm_data->tm_end_threshold = sc.players * 0.2;
+	else
+		tm->tm_data->tm_end_threshold = PLAYERS_PER_MATCH - 1;
+	tm->tm_data->tm_phase = TM_RUNNING;
 	tm->tm_data->tm_on_beach_players = 0;
 	tm->tm_data->tm_idle_courts = (sc.rows * sc.cols);
+	tm->tm_data->tm_row_steals = 0;
+	tm->tm_data->tm_waiting.wq_head = 0;
+	tm->tm_data->tm_waiting.wq_size = 0;
+	for (i = 0; i < TM_MAX_SUSPENDED; i++)
+		tm->tm_data->tm_suspended[i].sm_in_use = false;
+	tm->tm_data->tm_suspend_seq = 0;
+	tm->tm_data->tm_resumed_matches = 0;
 
 	tm->tm_data->tm_players_sem = -1;
 	tm->tm_data->tm_courts_sem = -1;
 	tm->tm_data->tm_init_sem = -1;
-	tm->tm_data->pt = NULL;
-	tm->tm_data->st = NULL;
 	tm->tm_data->tm_tide_lvl = -1;
-	
-	tm->total_players = sc.players;
-	tm->total_courts = (sc.rows * sc.cols);
-	tm->num_matches = sc.matches;
+	tm->tm_data->tm_balanced_teams = sc.balanced;
+}
+
+/* Puts the received player at the end of the waiting room,
+ * unless they are already there. The player should then park
+ * on their semaphore of tm_players_sem. A wake up left over
+ * from an earlier wait (given right as it timed out) is
+ * dropped, so that it doesn't cut the next one short.
+ * Pre: the process has the tournament lock.*/
+void tournament_wait_enqueue(tournament_t* tm, unsigned int player_id) {
+	if ((!tm) || (player_id >= MAX_PLAYERS)) return;
+	player_state_t* ps = &tm->tm_data->tm_players_state[player_id];
+	wait_queue_t* wq = &tm->tm_data->tm_waiting;
+	if (ps->player_waiting || (wq->wq_size == MAX_PLAYERS)) return;
+	while (sem_trywait(tm->tm_data->tm_players_sem, player_id) == 0);
+
+	wq->wq_players[(wq->wq_head + wq->wq_size) % MAX_PLAYERS] = player_id;
+	wq->wq_size++;
+	ps->player_waiting = true;
+}
+
+/* Wakes up to max players from the waiting room, first come
+ * first served. Should be called whenever a court gets room
+ * for more players. Returns the amount woken.
+ * Pre: the process has the tournament lock.*/
+unsigned int tournament_wake_waiting(tournament_t* tm, unsigned int max) {
+	if (!tm) return 0;
+	wait_queue_t* wq = &tm->tm_data->tm_waiting;
+	unsigned int woken = 0;
+	while ((woken < max) && (wq->wq_size > 0)) {
+		unsigned int player_id = wq->wq_players[wq->wq_head];
+		wq->wq_head = (wq->wq_head + 1) % MAX_PLAYERS;
+		wq->wq_size--;
+		tm->tm_data->tm_players_state[player_id].player_waiting = false;
+		sem_post(tm->tm_data->tm_players_sem, player_id);
+		woken++;
+	}
+	return woken;
+}
+
+/* Takes the received player out of the waiting room, without
+ * waking them up: they gave up waiting, or found a court on
+ * their own. Returns true if they were there.
+ * Pre: the process has the tournament lock.*/
+bool tournament_wait_leave(tournament_t* tm, unsigned int player_id) {
+	if ((!tm) || (player_id >= MAX_PLAYERS)) return false;
+	player_state_t* ps = &tm->tm_data->tm_players_state[player_id];
+	if (!ps->player_waiting) return false;
+	wait_queue_t* wq = &tm->tm_data->tm_waiting;
+	unsigned int i, k = 0;
+	// Everyone else keeps their turn
+	for (i = 0; i < wq->wq_size; i++) {
+		unsigned int waiting = wq->wq_players[(wq->wq_head + i) % MAX_PLAYERS];
+		if (waiting != player_id)
+			wq->wq_players[(wq->wq_head + k++) % MAX_PLAYERS] = waiting;
+	}
+	wq->wq_size = k;
+	ps->player_waiting = false;
+	return true;
+}
+
+/* Wakes the received player if they are on the waiting room,
+ * taking them out of it.
+ * Pre: the process has the tournament lock.*/
+void tournament_wake_player(tournament_t* tm, unsigned int player_id) {
+	if (tournament_wait_leave(tm, player_id))
+		sem_post(tm->tm_data->tm_players_sem, player_id);
+}
+
+/* Checkpoints the match the received players (in court id
+ * order) were playing on court_id, with sets_won sets won by
+ * each team. Returns its index on tm_suspended, or -1 if
+ * there's no room to keep it.
+ * Pre: the process has the tournament lock.*/
+int tournament_suspend_match(tournament_t* tm, const unsigned int* players, const uint8_t* sets_won, unsigned int court_id) {
+	if ((!tm) || (court_id >= tm->total_courts)) return -1;
+	int sm;
+	for (sm = 0; sm < TM_MAX_SUSPENDED; sm++)
+		if (!tm->tm_data->tm_suspended[sm].sm_in_use) break;
+	if (sm == TM_MAX_SUSPENDED) return -1;
+
+	suspended_match_t* m = &tm->tm_data->tm_suspended[sm];
+	int i;
+	for (i = 0; i < PLAYERS_PER_MATCH; i++) {
+		m->sm_players[i] = players[i];
+		tm->tm_data->tm_players_state[players[i]].player_suspended = sm;
+	}
+	m->sm_sets_won[0] = sets_won[0];
+	m->sm_sets_won[1] = sets_won[1];
+	m->sm_flooded_court = court_id;
+	m->sm_court = -1;
+	m->sm_seq = tm->tm_data->tm_suspend_seq++;
+	m->sm_in_use = true;
+	tm->tm_data->tm_courts[court_id].court_suspended_matches++;
+	return sm;
+}
+
+/* Marks the received court (with no players in) as free. If a
+ * suspended match is waiting for a court, the court claims it
+ * instead, and its players are woken up. Slots kept for players
+ * still on their way (see kick_all_players) rule the claim out.
+ * Pre: the process has the tournament lock.*/
+void tournament_court_freed(tournament_t* tm, unsigned int court_id) {
+	if ((!tm) || (court_id >= tm->total_courts)) return;
+	uint8_t num_players = TM_COURT_NUM_PLAYERS(tm, court_id);
+	int sm, oldest = -1;
+	for (sm = 0; (num_players == 0) && (sm < TM_MAX_SUSPENDED); sm++) {
+		suspended_match_t* m = &tm->tm_data->tm_suspended[sm];
+		if ((!m->sm_in_use) || (m->sm_court >= 0)) continue;
+		if ((oldest < 0) || ((int) (m->sm_seq - tm->tm_data->tm_suspended[oldest].sm_seq) < 0))
+			oldest = sm;
+	}
+	if (oldest < 0) {
+		if (num_players >= PLAYERS_PER_MATCH) {
+			TM_COURT_STATUS(tm, court_id) = TM_C_BUSY;
+			return;
+		}
+		TM_COURT_STATUS(tm, court_id) = TM_C_FREE;
+		tournament_wake_waiting(tm, TM_WAKE_FANOUT);
+		return;
+	}
+
+	suspended_match_t* m = &tm->tm_data->tm_suspended[oldest];
+	m->sm_court = court_id;
+	tm->tm_data->tm_courts[court_id].court_resume = oldest;
+	TM_COURT_STATUS(tm, court_id) = TM_C_LOBBY;
+	int i;
+	for (i = 0; i < PLAYERS_PER_MATCH; i++)
+		tournament_wake_player(tm, m->sm_players[i]);
+}
+
+/* Floods the received court, and wakes it up wherever it's
+ * waiting. A suspended match it claimed goes back to wait for
+ * another court.
+ * Pre: the process has the tournament lock.*/
+void tournament_court_flooded(tournament_t* tm, unsigned int court_id) {
+	if ((!tm) || (court_id >= tm->total_courts)) return;
+	TM_COURT_STATUS(tm, court_id) = TM_C_FLOODED;
+	court_data_t* cd = &tm->tm_data->tm_courts[court_id];
+	if (cd->court_resume >= 0) {
+		tm->tm_data->tm_suspended[cd->court_resume].sm_court = -1;
+		cd->court_resume = -1;
+	}
+	// Playing a set, the court sleeps on the flood word; waiting
+	// for players, on its semaphore
+	__atomic_store_n(&cd->court_flood, 1, __ATOMIC_RELEASE);
+	futex_wake(&cd->court_flood, INT_MAX);
+	tournament_wake_court(tm, court_id);
+}
+
+/* The water goes down on the received flooded court: it's woken
+ * up. It stays marked as flooded until the court itself, done
+ * with the flood, frees it: mid set, it may not have noticed.
+ * Pre: the process has the tournament lock.*/
+void tournament_court_dried(tournament_t* tm, unsigned int court_id) {
+	if ((!tm) || (court_id >= tm->total_courts)) return;
+	court_data_t* cd = &tm->tm_data->tm_courts[court_id];
+	__atomic_store_n(&cd->court_flood, 0, __ATOMIC_RELEASE);
+	futex_wake(&cd->court_flood, INT_MAX);
+}
+
+/* Takes the suspended match claimed by the received court off
+ * tm_suspended, as the court is resuming it.
+ * Pre: the process has the tournament lock.*/
+void tournament_resume_match(tournament_t* tm, unsigned int court_id) {
+	if ((!tm) || (court_id >= tm->total_courts)) return;
+	court_data_t* cd = &tm->tm_data->tm_courts[court_id];
+	if (cd->court_resume < 0) return;
+	suspended_match_t* m = &tm->tm_data->tm_suspended[cd->court_resume];
+	int i;
+	for (i = 0; i < PLAYERS_PER_MATCH; i++)
+		tm->tm_data->tm_players_state[m->sm_players[i]].player_suspended = -1;
+	m->sm_in_use = false;
+	cd->court_resume = -1;
+	tm->tm_data->tm_resumed_matches++;
+}
+
+/* Forgets the suspended match of the received player, if any,
+ * as they are leaving. A court claiming it is woken up, so it
+ * doesn't wait for them.
+ * Pre: the process has the tournament lock.*/
+void tournament_drop_suspended(tournament_t* tm, unsigned int player_id) {
+	if ((!tm) || (player_id >= MAX_PLAYERS)) return;
+	int sm = tm->tm_data->tm_players_state[player_id].player_suspended;
+	if (sm < 0) return;
+	suspended_match_t* m = &tm->tm_data->tm_suspended[sm];
+	int i;
+	// The rest are free to play anybody, right now
+	for (i = 0; i < PLAYERS_PER_MATCH; i++) {
+		tm->tm_data->tm_players_state[m->sm_players[i]].player_suspended = -1;
+		tournament_wake_player(tm, m->sm_players[i]);
+	}
+	m->sm_in_use = false;
+	if (m->sm_court < 0) return;
+
+	unsigned int court_id = m->sm_court;
+	tm->tm_data->tm_courts[court_id].court_resume = -1;
+	if (TM_COURT_NUM_PLAYERS(tm, court_id) == 0)
+		tournament_court_freed(tm, court_id);
+	else
+		tournament_wake_court(tm, court_id);
+}
+
+/* Returns the current tournament phase. No lock needed.*/
+tm_phase tournament_phase(tournament_t* tm) {
+	return (tm_phase) __atomic_load_n(&tm->tm_data->tm_phase, __ATOMIC_ACQUIRE);
+}
+
+/* Sleeps up to usec microseconds, unless the tournament leaves
+ * the received phase first. Returns true if the whole time was
+ * slept, or false if the phase changed.*/
+bool tournament_wait_phase(tournament_t* tm, tm_phase phase, unsigned long int usec) {
+	return tournament_wait_phase_until(tm, phase, latency_now() + usec);
+}
+
+/* Same as tournament_wait_phase, but sleeps until deadline, an
+ * absolute time as latency_now gives.*/
+bool tournament_wait_phase_until(tournament_t* tm, tm_phase phase, uint64_t deadline) {
+	while (latency_now() < deadline) {
+		if (tournament_phase(tm) != phase)
+			return false;
+		futex_wait_until(&tm->tm_data->tm_phase, phase, deadline);
+	}
+	return (tournament_phase(tm) == phase);
+}
+
+/* Accounts for an active player leaving. If that leaves few
+ * enough players, the drain starts (see tournament_begin_drain).
+ * Pre: the process has the tournament lock.*/
+void tournament_player_left(tournament_t* tm) {
+	if (!tm) return;
+	tm->tm_data->tm_active_players--;
+	if (tm->tm_data->tm_active_players <= tm->tm_data->tm_end_threshold)
+		tournament_begin_drain(tm);
+}
+
+/* Starts draining the tournament, unless it already was: the
+ * waiting room is emptied, and every phase sleeper and main are
+ * notified. Returns true if the drain started on this call.
+ * Pre: the process has the tournament lock.*/
+bool tournament_begin_drain(tournament_t* tm) {
+	if ((!tm) || (tournament_phase(tm) != TM_RUNNING)) return false;
+	__atomic_store_n(&tm->tm_data->tm_phase, TM_DRAINING, __ATOMIC_RELEASE);
+	// Nobody will find a court anymore
+	tournament_wake_waiting(tm, MAX_PLAYERS);
+	futex_wake(&tm->tm_data->tm_phase, INT_MAX);
+	if (tm->tm_end_fd >= 0) {
+		uint64_t one = 1;
+		if (write(tm->tm_end_fd, &one, sizeof(one)) < 0)
+			log_write(ERROR_L, "Tournament: Couldn't notify the drain to main [errno: %d]\n", errno);
+	}
+	return true;
+}
+
+/* Ends the tournament, notifying every phase sleeper. Water
+ * goes down everywhere, so flooded courts wake up too; courts
+ * waiting for players have to be woken with tournament_wake_court.
+ * Pre: the process has the tournament lock.*/
+void tournament_end(tournament_t* tm) {
+	if (!tm) return;
+	__atomic_store_n(&tm->tm_data->tm_phase, TM_ENDED, __ATOMIC_RELEASE);
+	futex_wake(&tm->tm_data->tm_phase, INT_MAX);
+	int i;
+	for (i = 0; i < tm->total_courts; i++) {
+		__atomic_store_n(&tm->tm_data->tm_courts[i].court_flood, 0, __ATOMIC_RELEASE);
+		futex_wake(&tm->tm_data->tm_courts[i].court_flood, INT_MAX);
+	}
+}
+
+/* Posts on the court semaphore on behalf of main, so that a
+ * court waiting for players looks at the phase.
+ * Pre: the process has the tournament lock.*/
+void tournament_wake_court(tournament_t* tm, unsigned int court_id) {
+	if ((!tm) || (court_id >= tm->total_courts)) return;
+	tm->tm_data->tm_courts[court_id].court_wakeups++;
+	sem_post(tm->tm_data->tm_courts_sem, court_id);
+}
+
+/* Tells whether the court semaphore post the court just took
+ * was made by tournament_wake_court (true), or by a player.
+ * Pre: the process has the tournament lock.*/
+bool tournament_court_take_wakeup(tournament_t* tm, unsigned int court_id) {
+	if ((!tm) || (court_id >= tm->total_courts)) return false;
+	court_data_t* cd = &tm->tm_data->tm_courts[court_id];
+	if (cd->court_wakeups == 0) return false;
+	cd->court_wakeups--;
+	return true;
 }
 
 void tournament_destroy(tournament_t* tm) {
 	if (!tm) return;
+	if (tm->tm_end_fd >= 0)
+		close(tm->tm_end_fd);
+	score_table_destroy(tm->st);
+	partners_table_destroy(tm->pt);
+	latency_table_destroy(tm->lt);
 	lock_destroy(tm->tm_lock);
 
 	// Detaches shared memory 
-	shmdt((void*) tm->tm_data);
+	arena_destroy(tm->tm_arena);
 	free(tm);
 }
 
@@ -99,17 +495,9 @@ void tournament_free(tournament_t* tm) {
 		sem_destroy(tm->tm_data->tm_courts_sem);
 	if (tm->tm_data->tm_init_sem >= 0)
 		sem_destroy(tm->tm_data->tm_init_sem);
-	if (tm->tm_data->tm_courts_flood_sem >= 0)
-		sem_destroy(tm->tm_data->tm_courts_flood_sem);
 		
-	int shmid = tm->tm_shmid;
+	arena_t* arena = tm->tm_arena;
+	tm->tm_arena = NULL;
 	tournament_destroy(tm);
-	shmctl(shmid, IPC_RMID, NULL);
-}
-
-/* Should be called after launching players.*/
-void tournament_set_tables(tournament_t* tm, partners_table_t* pt, score_table_t* st){
-	if(!tm) return;
-	tm->tm_data->st = st;
-	tm->tm_data->pt = pt;
+	arena_free(arena);
 }
@@ -1,16 +1,33 @@
 #ifndef TOURNAMENT_H
 #define TOURNAMENT_H
 
+#include <stdint.h>
 #include "lock.h"
 #include "protocol.h"
 #include "semaphore.h"
 #include "score_table.h"
 #include "partners_table.h"
+#include "latency_table.h"
+#include "arena.h"
+#include "tuning.h"
 #include "confparser.h"
 
 #define MAX_NUM_MATCHES 40
 #define NAME_MAX_LENGTH 50
 
+// Set this flag to give every court record and every hot counter
+// its own cache line, so that a process writing one doesn't
+// invalidate the lines the others are scanning; clear it to
+// get the packed layout back
+#define TM_PADDED_LAYOUT 1
+#define TM_CACHE_LINE 64
+
+#if TM_PADDED_LAYOUT
+#define TM_CACHE_ALIGNED __attribute__((aligned(TM_CACHE_LINE)))
+#else
+#define TM_CACHE_ALIGNED
+#endif
+
 /*
  * Tournament distributed information. Everyone should be able
  * to access and modify, previously locking the TDA.
@@ -31,6 +48,16 @@ typedef enum _court_status {
 	TM_C_DISABLED
 } c_status;
 
+/* The tournament runs until few enough players remain active
+ * (see tm_end_threshold). Then it drains: matches on course are
+ * played till the end, but lobbies reject everyone and players
+ * leave. Once every player is gone, it ends and courts leave.*/
+typedef enum _tournament_phase {
+	TM_RUNNING,
+	TM_DRAINING,
+	TM_ENDED
+} tm_phase;
+
 
 typedef struct _match_data {
 	int match_players[PLAYERS_PER_MATCH];
@@ -38,62 +65,280 @@ typedef struct _match_data {
 	int match_played_at;
 } match_data_t;
 
-typedef struct _player_data {
+/* Hot player fields, read and written while the tournament runs.*/
+typedef struct _player_state {
 	int player_pid;
-	char player_name[NAME_MAX_LENGTH];
 	p_status player_status;
+	unsigned int player_skill;
+	bool player_waiting;
+	// Suspended match waiting for them (see tm_suspended), or -1
+	int player_suspended;
+} player_state_t;
+
+/* Waiting room: players who found no room on any court, in
+ * arrival order. Each one parks on their own semaphore of
+ * tm_players_sem until woken (see tournament_wake_waiting).*/
+typedef struct _wait_queue {
+	unsigned int wq_head;
+	unsigned int wq_size;
+	unsigned int wq_players[MAX_PLAYERS];
+} wait_queue_t;
 
+// Players woken when a whole court becomes free
+#define TM_WAKE_FANOUT PLAYERS_PER_MATCH
+
+/* Match suspended by the tide, checkpointed so that its four
+ * players can finish it later. The first court to get free
+ * claims it (sm_court) and waits for just them; the match then
+ * goes on from the sets already played.*/
+typedef struct _suspended_match {
+	bool sm_in_use;
+	// Players in court id order: home team first
+	unsigned int sm_players[PLAYERS_PER_MATCH];
+	uint8_t sm_sets_won[2];
+	// Court where it was suspended, and court claiming it (-1
+	// while none does)
+	int sm_flooded_court;
+	int sm_court;
+	// Claims are first come first served
+	unsigned int sm_seq;
+} suspended_match_t;
+
+// Every player is on one suspended match at most
+#define TM_MAX_SUSPENDED (MAX_PLAYERS / PLAYERS_PER_MATCH)
+
+/* Cold player fields: only written once a match is over, and
+ * read for the final report.*/
+typedef struct _player_data {
+	char player_name[NAME_MAX_LENGTH];
 	match_data_t player_matches[MAX_NUM_MATCHES];
 	int player_num_matches;
 } player_data_t;
 
 
+/* Court fields not needed to look for a court. Status and
+ * amount of players live on tm_court_status and
+ * tm_court_num_players, so that scans only touch bytes.*/
 typedef struct _court_data {
 	unsigned int court_players[PLAYERS_PER_MATCH];
 	int court_pid;
-	int court_num_players;
-	c_status court_status;
+	// When the match on course should end, as a latency_now
+	// timestamp; 0 if there's no match on course
+	uint64_t court_predicted_end;
+
+	// Posts on the court semaphore made by main instead of a
+	// player, to tell the court something changed on the phase
+	unsigned int court_wakeups;
+	// Flood word: non zero while the court is under water. It's
+	// a futex (see futex.h) the court sleeps on while flooded,
+	// or while a set is played, so the tide wakes it right away
+	uint32_t court_flood;
+	// Channel the court tells its players about the match on
+	broadcast_t court_broadcast;
+	// Suspended match claimed by the court (see tm_suspended),
+	// or -1. The court is on TM_C_LOBBY meanwhile
+	int court_resume;
 
 	int court_completed_matches;
 	int court_suspended_matches;
-} court_data_t;
+} TM_CACHE_ALIGNED court_data_t;
 
 typedef struct tournament_data {
-	player_data_t tm_players[MAX_PLAYERS];
+	player_state_t tm_players_state[MAX_PLAYERS];
+	// Court state as a structure of arrays (see court_scan.h),
+	// indexed by slot (see TM_COURT_SLOT)
+	uint8_t tm_court_status[MAX_COURTS] TM_CACHE_ALIGNED;
+	uint8_t tm_court_num_players[MAX_COURTS] TM_CACHE_ALIGNED;
 	court_data_t tm_courts[MAX_COURTS];
-	// General stats.
-	unsigned int tm_on_beach_players;
-	unsigned int tm_active_players;
+	// General stats. The hot ones get a line each
+	unsigned int tm_on_beach_players TM_CACHE_ALIGNED;
+	unsigned int tm_active_players TM_CACHE_ALIGNED;
+	unsigned int tm_end_threshold;
+	// Tournament phase, also a futex word (see futex.h)
+	uint32_t tm_phase TM_CACHE_ALIGNED;
+	int tm_tide_lvl TM_CACHE_ALIGNED;
+
+	unsigned int tm_idle_courts TM_CACHE_ALIGNED;
+	unsigned int tm_row_steals;
 
-	unsigned int tm_idle_courts;
+	wait_queue_t tm_waiting TM_CACHE_ALIGNED;
+	suspended_match_t tm_suspended[TM_MAX_SUSPENDED];
+	unsigned int tm_suspend_seq;
+	unsigned int tm_resumed_matches;
 	unsigned int tm_active_courts;
 
 	int tm_players_sem;
 	int tm_courts_sem;
-	int tm_courts_flood_sem;
 	
 	int tm_init_sem;
 
-	int tm_tide_lvl;
+	// Matchmaking policy: split teams by skill
+	bool tm_balanced_teams;
 	
-	partners_table_t* pt;
-	score_table_t* st;
+	// Sizes, so that attached processes can rebuild their handles
+	size_t tm_total_players;
+	size_t tm_total_courts;
+	size_t tm_rows;
+	size_t tm_cols;
+	size_t tm_num_matches;
+
+	// Seed of every random choice, or 0 to take it from the clock
+	size_t tm_seed;
+
+	// Where each table lives inside the arena
+	arena_off_t tm_pt_off;
+	arena_off_t tm_st_off;
+	arena_off_t tm_lt_off;
+	arena_off_t tm_tuning_off;
+
+	// Cold player data goes last, away from everything else
+	player_data_t tm_players[MAX_PLAYERS];
 } tournament_data_t;
 
+/* Per process view of the tournament. Everything shared lives
+ * on the arena; the table handles are built by each process
+ * from the offsets stored at tm_data.*/
 typedef struct tournament {
 	size_t total_players;
 	size_t total_courts;
+	size_t rows;
+	size_t cols;
 	size_t num_matches;
-	int tm_shmid;
+	arena_t *tm_arena;
 	tournament_data_t *tm_data;
 	lock_t *tm_lock;
+	// Eventfd main sleeps on, signaled when the drain starts;
+	// -1 on attached processes
+	int tm_end_fd;
+
+	partners_table_t* pt;
+	score_table_t* st;
+	latency_table_t* lt;
+	// Read only, see tuning.h
+	const tuning_t* tuning;
 } tournament_t;
 
 
+/* Court state arrays are laid out by row, the way the tide sees
+ * courts (court i is on row i % rows), so that each row is a run
+ * of cols contiguous bytes. These map court ids to slots and back.*/
+#define TM_COURT_SLOT(tm, court_id) (((court_id) % (tm)->rows) * (tm)->cols + (court_id) / (tm)->rows)
+#define TM_SLOT_COURT(tm, slot) (((slot) % (tm)->cols) * (tm)->rows + (slot) / (tm)->cols)
+#define TM_COURT_STATUS(tm, court_id) ((tm)->tm_data->tm_court_status[TM_COURT_SLOT((tm), (court_id))])
+#define TM_COURT_NUM_PLAYERS(tm, court_id) ((tm)->tm_data->tm_court_num_players[TM_COURT_SLOT((tm), (court_id))])
+
+/* Puts the received player at the end of the waiting room,
+ * unless they are already there. The player should then park
+ * on their semaphore of tm_players_sem. A wake up left over
+ * from an earlier wait (given right as it timed out) is
+ * dropped, so that it doesn't cut the next one short.
+ * Pre: the process has the tournament lock.*/
+void tournament_wait_enqueue(tournament_t* tm, unsigned int player_id);
+
+/* Wakes up to max players from the waiting room, first come
+ * first served. Should be called whenever a court gets room
+ * for more players. Returns the amount woken.
+ * Pre: the process has the tournament lock.*/
+unsigned int tournament_wake_waiting(tournament_t* tm, unsigned int max);
+
+/* Takes the received player out of the waiting room, without
+ * waking them up: they gave up waiting, or found a court on
+ * their own. Returns true if they were there.
+ * Pre: the process has the tournament lock.*/
+bool tournament_wait_leave(tournament_t* tm, unsigned int player_id);
+
+/* Wakes the received player if they are on the waiting room,
+ * taking them out of it.
+ * Pre: the process has the tournament lock.*/
+void tournament_wake_player(tournament_t* tm, unsigned int player_id);
+
+/* Checkpoints the match the received players (in court id
+ * order) were playing on court_id, with sets_won sets won by
+ * each team. Returns its index on tm_suspended, or -1 if
+ * there's no room to keep it.
+ * Pre: the process has the tournament lock.*/
+int tournament_suspend_match(tournament_t* tm, const unsigned int* players, const uint8_t* sets_won, unsigned int court_id);
+
+/* Marks the received court (with no players in) as free. If a
+ * suspended match is waiting for a court, the court claims it
+ * instead, and its players are woken up. Slots kept for players
+ * still on their way (see kick_all_players) rule the claim out.
+ * Pre: the process has the tournament lock.*/
+void tournament_court_freed(tournament_t* tm, unsigned int court_id);
+
+/* Floods the received court, and wakes it up wherever it's
+ * waiting. A suspended match it claimed goes back to wait for
+ * another court.
+ * Pre: the process has the tournament lock.*/
+void tournament_court_flooded(tournament_t* tm, unsigned int court_id);
+
+/* The water goes down on the received flooded court: it's woken
+ * up. It stays marked as flooded until the court itself, done
+ * with the flood, frees it: mid set, it may not have noticed.
+ * Pre: the process has the tournament lock.*/
+void tournament_court_dried(tournament_t* tm, unsigned int court_id);
+
+/* Takes the suspended match claimed by the received court off
+ * tm_suspended, as the court is resuming it.
+ * Pre: the process has the tournament lock.*/
+void tournament_resume_match(tournament_t* tm, unsigned int court_id);
+
+/* Forgets the suspended match of the received player, if any,
+ * as they are leaving. A court claiming it is woken up, so it
+ * doesn't wait for them.
+ * Pre: the process has the tournament lock.*/
+void tournament_drop_suspended(tournament_t* tm, unsigned int player_id);
+
+/* Returns the current tournament phase. No lock needed.*/
+tm_phase tournament_phase(tournament_t* tm);
+
+/* Sleeps up to usec microseconds, unless the tournament leaves
+ * the received phase first. Returns true if the whole time was
+ * slept, or false if the phase changed.*/
+bool tournament_wait_phase(tournament_t* tm, tm_phase phase, unsigned long int usec);
+
+/* Same as tournament_wait_phase, but sleeps until deadline, an
+ * absolute time as latency_now gives.*/
+bool tournament_wait_phase_until(tournament_t* tm, tm_phase phase, uint64_t deadline);
+
+/* Accounts for an active player leaving. If that leaves few
+ * enough players, the drain starts (see tournament_begin_drain).
+ * Pre: the process has the tournament lock.*/
+void tournament_player_left(tournament_t* tm);
+
+/* Starts draining the tournament, unless it already was: the
+ * waiting room is emptied, and every phase sleeper and main are
+ * notified. Returns true if the drain started on this call.
+ * Pre: the process has the tournament lock.*/
+bool tournament_begin_drain(tournament_t* tm);
+
+/* Ends the tournament, notifying every phase sleeper. Water
+ * goes down everywhere, so flooded courts wake up too; courts
+ * waiting for players have to be woken with tournament_wake_court.
+ * Pre: the process has the tournament lock.*/
+void tournament_end(tournament_t* tm);
+
+/* Posts on the court semaphore on behalf of main, so that a
+ * court waiting for players looks at the phase.
+ * Pre: the process has the tournament lock.*/
+void tournament_wake_court(tournament_t* tm, unsigned int court_id);
+
+/* Tells whether the court semaphore post the court just took
+ * was made by tournament_wake_court (true), or by a player.
+ * Pre: the process has the tournament lock.*/
+bool tournament_court_take_wakeup(tournament_t* tm, unsigned int court_id);
+
+/* Creates the tournament arena, with the tournament data and
+ * every shared table on it. Returns NULL on error.*/
 tournament_t* tournament_create(struct conf sc);
+
+/* Attaches to the tournament created by another process, even
+ * if it's not related to it. Returns NULL on error.*/
+tournament_t* tournament_attach();
+
 void tournament_init(tournament_t* tm, struct conf sc);
 void tournament_shmrm(tournament_t* tm);
 void tournament_destroy(tournament_t* tm);
-void tournament_set_tables(tournament_t* tm, partners_table_t* pt, score_table_t* st);
+void tournament_free(tournament_t* tm);
 
 #endif // TOURNAMENT_H
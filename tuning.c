@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "log.h"
+#include "tuning.h"
+
+/* Auxiliar function that returns the page size.*/
+static size_t tuning_page_size(){
+	long page = sysconf(_SC_PAGESIZE);
+	return (page > 0) ? (size_t) page : 4096;
+}
+
+/* Auxiliar function that returns where, inside shm, the
+ * block starts: on the first page boundary, so that it can
+ * be protected without touching its neighbours.*/
+static tuning_t* tuning_block(void* shm){
+	size_t page = tuning_page_size();
+	uintptr_t p = ((uintptr_t) shm + page - 1) & ~((uintptr_t) page - 1);
+	return (tuning_t*) p;
+}
+
+/* Auxiliar function that write protects the block, if
+ * TUNING_READ_ONLY is set. Huge page mappings can't be
+ * protected page by page, so then the block is left as is.*/
+static void tuning_seal(tuning_t* tn){
+#if TUNING_READ_ONLY
+	size_t page = tuning_page_size();
+	size_t len = (sizeof(tuning_t) + page - 1) & ~(page - 1);
+	if(mprotect(tn, len, PROT_READ) < 0)
+		log_write(INFO_L, "Tuning: Block left writable [errno: %d]\n", errno);
+#endif
+}
+
+/* Auxiliar function that scales usec, never going below
+ * min_usec (times used as a modulus can't be 0).*/
+static uint64_t tuning_scale_at_least(uint64_t scale, uint64_t usec, uint64_t min_usec){
+	uint64_t t = usec / scale;
+	return (t < min_usec) ? min_usec : t;
+}
+
+/* Returns the amount of shared memory the tuning block
+ * needs, counting the room to align it to a page.*/
+size_t tuning_shm_size(){
+	size_t page = tuning_page_size();
+	return ((sizeof(tuning_t) + page - 1) & ~(page - 1)) + page;
+}
+
+/* Fills the tuning block placed at shm (which must be shared
+ * memory of tuning_shm_size bytes) from the configuration
+ * received, and write protects it. Returns NULL on error.*/
+const tuning_t* tuning_create(void* shm, struct conf sc){
+	if(!shm) return NULL;
+	tuning_t* tn = tuning_block(shm);
+	uint64_t scale = (sc.time_scale ? sc.time_scale : 1);
+
+	memset(tn, 0, sizeof(tuning_t));
+	tn->time_scale = scale;
+	tn->score_min = tuning_scale_at_least(scale, sc.score_min, 0);
+	tn->score_max = tuning_scale_at_least(scale, sc.score_max, 1);
+	tn->set_min = tuning_scale_at_least(scale, sc.set_min, 0);
+	tn->set_max = tuning_scale_at_least(scale, sc.set_max, tn->set_min + 1);
+	tn->rest_max = tuning_scale_at_least(scale, sc.rest_max, 1);
+	tn->retry_max = tuning_scale_at_least(scale, sc.retry_max, 1);
+	tn->park_timeout = tuning_scale_at_least(scale, sc.park_timeout, 1);
+	tn->park_grace = tuning_scale_at_least(scale, sc.park_grace, 0);
+	tn->backoff_min = tuning_scale_at_least(scale, sc.backoff_min, 1);
+	tn->retry_policy = (unsigned int) sc.retry_policy;
+	tn->leave_prob = (unsigned int) sc.leave_prob;
+	tn->rest_prob = (unsigned int) sc.rest_prob;
+	tn->max_attempts = (unsigned int) sc.max_attempts;
+
+	tuning_seal(tn);
+	return tn;
+}
+
+/* Returns the tuning block already filled at shm, write
+ * protecting it on this process too. Returns NULL on error.*/
+const tuning_t* tuning_attach(void* shm){
+	if(!shm) return NULL;
+	tuning_t* tn = tuning_block(shm);
+	tuning_seal(tn);
+	return tn;
+}
+
+/* Returns the time (in microseconds) usec takes once
+ * compressed by the time scale of the tuning block.*/
+uint64_t tuning_scale(const tuning_t* tn, uint64_t usec){
+	if((!tn) || (tn->time_scale <= 1)) return usec;
+	return usec / tn->time_scale;
+}
@@ -0,0 +1,74 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "confparser.h"
+
+// Set this flag to write protect the tuning block once it's
+// filled; clear it to leave it writable (e.g. for debuggers)
+#define TUNING_READ_ONLY 1
+
+// Defaults of every tuning parameter. In microseconds!
+#define TUNING_SCORE_MIN	900	// Best players' time to score a point
+#define TUNING_SCORE_MAX	3000	// Worst players' time, also the random part
+#define TUNING_SET_MIN		70000
+#define TUNING_SET_MAX		200000
+#define TUNING_REST_MAX		5000000	// Longest time resting off the beach
+#define TUNING_RETRY_MAX	2000000	// Longest rest after playing a match
+#define TUNING_PARK_TIMEOUT	2000000	// Longest wait for a court before searching again
+#define TUNING_PARK_GRACE	50000	// How late a predicted release can be
+#define TUNING_BACKOFF_MIN	20000	// First wait after a failed search (see retry.h)
+// In percent!
+#define TUNING_LEAVE_PROB	2	// Leaving the tournament completely
+#define TUNING_REST_PROB	15	// Resting for ~U(0, REST_MAX). Includes LEAVE_PROB
+// Failed searches in a row before giving up
+#define TUNING_MAX_ATTEMPTS	10
+
+/*
+ * Every timing constant of players and courts lives on the tuning
+ * block, which is carved from the arena and filled from struct
+ * conf once, at setup. Then it's write protected, so no process
+ * can change the pace of the tournament halfway through.
+ *
+ * Times are stored already divided by time_scale, so everybody
+ * just sleeps what the block says: running with a time_scale
+ * of 100 plays the very same tournament 100 times faster.
+ */
+typedef struct tuning_ {
+	uint64_t time_scale;
+	uint64_t score_min;
+	uint64_t score_max;
+	uint64_t set_min;
+	uint64_t set_max;
+	uint64_t rest_max;
+	uint64_t retry_max;
+	uint64_t park_timeout;
+	uint64_t park_grace;
+	uint64_t backoff_min;
+	unsigned int retry_policy;
+	unsigned int leave_prob;
+	unsigned int rest_prob;
+	unsigned int max_attempts;
+} tuning_t;
+
+/* Returns the amount of shared memory the tuning block
+ * needs, counting the room to align it to a page.*/
+size_t tuning_shm_size();
+
+/* Fills the tuning block placed at shm (which must be shared
+ * memory of tuning_shm_size bytes) from the configuration
+ * received, and write protects it. Returns NULL on error.*/
+const tuning_t* tuning_create(void* shm, struct conf sc);
+
+/* Returns the tuning block already filled at shm, write
+ * protecting it on this process too. Returns NULL on error.*/
+const tuning_t* tuning_attach(void* shm);
+
+/* Returns the time (in microseconds) usec takes once
+ * compressed by the time scale of the tuning block.*/
+uint64_t tuning_scale(const tuning_t* tn, uint64_t usec);
+
+#endif
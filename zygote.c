@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include "log.h"
+#include "tournament.h"
+#include "confparser.h"
+#include "player.h"
+#include "court.h"
+#include "tide.h"
+#include "zygote.h"
+
+/* Worker registry kept by the zygote, to tell main
+ * who finished when a pid is reaped.*/
+typedef struct zygote_worker_ {
+	pid_t pid;
+	zygote_role role;
+	unsigned int id;
+} zygote_worker_t;
+
+/* Auxiliar function that forks a worker from the zygote. The
+ * worker drops the zygote's pipes and signal mask, and then
+ * assumes the role requested. Returns the worker's pid, or a
+ * negative number on error.*/
+pid_t zygote_fork_worker(zygote_request_t req, tournament_t* tm, struct conf sc, int* fds, sigset_t* old_mask){
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+
+	// Son aka worker
+	int i;
+	for (i = 0; i < 3; i++)
+		close(fds[i]);
+	sigprocmask(SIG_SETMASK, old_mask, NULL);
+
+	switch (req.role) {
+		case ZYG_PLAYER:
+			player_main(req.id, tm);
+			break;
+		case ZYG_COURT:
+			court_main(req.id, tm);
+			break;
+		case ZYG_TIDE:
+			tide_main(tm, sc);
+			break;
+	}
+	assert(false); // Should not return!
+	exit(-1);
+}
+
+/* Auxiliar function that reports ev to main.*/
+void zygote_report(int event_fd, zygote_event_t ev){
+	if (write(event_fd, &ev, sizeof(ev)) < (ssize_t) sizeof(ev))
+		log_write(ERROR_L, "Zygote: Failed to report pid %d exit [errno: %d]\n", ev.pid, errno);
+}
+
+/* Auxiliar function that reaps every finished worker and
+ * reports it to main. Returns the amount reaped.*/
+int zygote_reap(zygote_worker_t* workers, int event_fd){
+	int reaped = 0, status, i;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < ZYGOTE_MAX_WORKERS; i++)
+			if (workers[i].pid == pid)
+				break;
+		if (i == ZYGOTE_MAX_WORKERS) continue;
+
+		zygote_event_t ev = {workers[i].role, workers[i].id, pid, status};
+		workers[i].pid = 0;
+		zygote_report(event_fd, ev);
+		reaped++;
+	}
+	return reaped;
+}
+
+/* Executes main for the zygote process. Serves spawn requests
+ * until main closes the request pipe, and then waits for every
+ * worker left. Finishes via exit(0).*/
+void zygote_main(tournament_t* tm, struct conf sc, int request_fd, int event_fd){
+	// SIGCHLD is read from a signalfd, together with the requests
+	sigset_t mask, old_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+	int sig_fd = signalfd(-1, &mask, 0);
+	if (sig_fd < 0) {
+		log_write(CRITICAL_L, "Zygote: signalfd failed [errno: %d]\n", errno);
+		exit(-1);
+	}
+	int fds[3] = {request_fd, event_fd, sig_fd};
+
+	zygote_worker_t workers[ZYGOTE_MAX_WORKERS] = {};
+	int alive = 0, i;
+	bool accepting = true;
+	log_write(INFO_L, "Zygote: Ready using PID: %d\n", getpid());
+
+	while (accepting || (alive > 0)) {
+		struct pollfd pfds[2] = {{sig_fd, POLLIN, 0}, {request_fd, POLLIN, 0}};
+		if (poll(pfds, (accepting ? 2 : 1), -1) < 0) {
+			if (errno == EINTR) continue;
+			log_write(CRITICAL_L, "Zygote: poll failed [errno: %d]\n", errno);
+			break;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			struct signalfd_siginfo si;
+			if (read(sig_fd, &si, sizeof(si)) < (ssize_t) sizeof(si))
+				log_write(ERROR_L, "Zygote: Bad read on signalfd [errno: %d]\n", errno);
+			alive -= zygote_reap(workers, event_fd);
+		}
+
+		if (accepting && (pfds[1].revents & (POLLIN | POLLHUP))) {
+			zygote_request_t req;
+			if (read(request_fd, &req, sizeof(req)) < (ssize_t) sizeof(req)) {
+				accepting = false; // Main is done requesting
+				continue;
+			}
+			for (i = 0; i < ZYGOTE_MAX_WORKERS; i++)
+				if (workers[i].pid == 0)
+					break;
+			pid_t pid = (i < ZYGOTE_MAX_WORKERS ? zygote_fork_worker(req, tm, sc, fds, &old_mask) : -1);
+			if (pid < 0) {
+				// Main already counts the worker, so it's told
+				// right away that it won't run
+				log_write(CRITICAL_L, "Zygote: Fork failed!\n");
+				zygote_event_t ev = {req.role, req.id, ZYGOTE_SPAWN_FAILED, 0};
+				zygote_report(event_fd, ev);
+				continue;
+			}
+			workers[i].pid = pid;
+			workers[i].role = req.role;
+			workers[i].id = req.id;
+			alive++;
+		}
+	}
+
+	close(sig_fd);
+	close(request_fd);
+	close(event_fd);
+	tournament_destroy(tm);
+	log_write(INFO_L, "Zygote: Finished process!\n");
+	log_close();
+	exit(0);
+}
+
+// ------------------------------------------------------------
+
+/* Forks the zygote process. Must be called by main once the
+ * tournament is ready. Returns NULL on error.*/
+zygote_t* zygote_start(tournament_t* tm, struct conf sc){
+	zygote_t* zg = malloc(sizeof(zygote_t));
+	if (!zg) return NULL;
+
+	int request_pipe[2], event_pipe[2];
+	if (pipe(request_pipe) < 0) {
+		free(zg);
+		return NULL;
+	}
+	if (pipe(event_pipe) < 0) {
+		close(request_pipe[0]);
+		close(request_pipe[1]);
+		free(zg);
+		return NULL;
+	}
+
+	zg->pid = fork();
+	if (zg->pid < 0) {
+		close(request_pipe[0]);
+		close(request_pipe[1]);
+		close(event_pipe[0]);
+		close(event_pipe[1]);
+		free(zg);
+		return NULL;
+	} else if (zg->pid == 0) { // Son aka zygote
+		close(request_pipe[1]);
+		close(event_pipe[0]);
+		free(zg);
+		zygote_main(tm, sc, request_pipe[0], event_pipe[1]);
+		assert(false); // Should not return!
+	}
+
+	close(request_pipe[0]);
+	close(event_pipe[1]);
+	zg->request_fd = request_pipe[1];
+	zg->event_fd = event_pipe[0];
+	return zg;
+}
+
+/* Asks the zygote to fork a new worker with the received
+ * role and id (ignored for the tide). Returns true if the
+ * request was sent, false otherwise.*/
+bool zygote_spawn(zygote_t* zg, zygote_role role, unsigned int id){
+	if (!zg) return false;
+	zygote_request_t req = {role, id};
+	return (write(zg->request_fd, &req, sizeof(req)) == sizeof(req));
+}
+
+/* Blocks until a worker finishes, and stores its exit report
+ * at ev. Returns false if the zygote is gone.*/
+bool zygote_next_exit(zygote_t* zg, zygote_event_t* ev){
+	if (!zg) return false;
+	ssize_t r;
+	do {
+		r = read(zg->event_fd, ev, sizeof(zygote_event_t));
+	} while ((r < 0) && (errno == EINTR));
+	return (r == sizeof(zygote_event_t));
+}
+
+/* Tells the zygote no more workers will be requested, waits
+ * for it to finish (after its workers) and frees the handle.*/
+void zygote_stop(zygote_t* zg){
+	if (!zg) return;
+	close(zg->request_fd);
+	waitpid(zg->pid, NULL, 0);
+	close(zg->event_fd);
+	free(zg);
+}
@@ -0,0 +1,70 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "tournament.h"
+#include "confparser.h"
+
+#define ZYGOTE_MAX_WORKERS (MAX_PLAYERS + MAX_COURTS + 1)
+
+/*
+ * The zygote is a process forked by main once the tournament is
+ * fully set up (shared memory mapped, log opened, tables
+ * initialized). Every player, court and tide is forked from it
+ * on demand, so workers start already initialized and main only
+ * has to write a request on a pipe. The zygote also reaps its
+ * workers and reports each exit back to main on another pipe.
+ */
+
+typedef enum zygote_role_ {
+	ZYG_PLAYER,
+	ZYG_COURT,
+	ZYG_TIDE
+} zygote_role;
+
+/* Spawn request, sent from main to the zygote.*/
+typedef struct zygote_request_ {
+	zygote_role role;
+	unsigned int id;
+} zygote_request_t;
+
+// Pid on the exit report of a worker that couldn't be forked
+#define ZYGOTE_SPAWN_FAILED -1
+
+/* Worker exit report, sent from the zygote to main. Also sent,
+ * with pid ZYGOTE_SPAWN_FAILED, for a worker never forked.*/
+typedef struct zygote_event_ {
+	zygote_role role;
+	unsigned int id;
+	int pid;
+	int status;
+} zygote_event_t;
+
+/* Main side handle of the zygote.*/
+typedef struct zygote_ {
+	pid_t pid;
+	int request_fd;
+	int event_fd;
+} zygote_t;
+
+/* Forks the zygote process. Must be called by main once the
+ * tournament is ready. Returns NULL on error.*/
+zygote_t* zygote_start(tournament_t* tm, struct conf sc);
+
+/* Asks the zygote to fork a new worker with the received
+ * role and id (ignored for the tide). Returns true if the
+ * request was sent, false otherwise.*/
+bool zygote_spawn(zygote_t* zg, zygote_role role, unsigned int id);
+
+/* Blocks until a worker finishes, and stores its exit report
+ * at ev. Returns false if the zygote is gone.*/
+bool zygote_next_exit(zygote_t* zg, zygote_event_t* ev);
+
+/* Tells the zygote no more workers will be requested, waits
+ * for it to finish (after its workers) and frees the handle.*/
+void zygote_stop(zygote_t* zg);
+
+#endif